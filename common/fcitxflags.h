@@ -37,6 +37,13 @@ enum FcitxCapabilityFlag : uint64_t {
     FcitxCapabilityFlag_ReportKeyRepeat = (1ull << 38),
     FcitxCapabilityFlag_ClientSideInputPanel = (1ull << 39),
     FcitxCapabilityFlag_Disable = (1ull << 40),
+    // Client only sends the keys matching the filter from UpdateKeyFilter.
+    FcitxCapabilityFlag_KeyFilter = (1ull << 47),
+    // Client applies UpdateClientSideUIHighlight when only the highlighted
+    // candidate or the preedit cursor changes. A client that lost what a
+    // delta applies to clears it, upon which the whole UI is sent again, and
+    // sets it again after that full update.
+    FcitxCapabilityFlag_ClientSideUIDelta = (1ull << 48),
 };
 
 enum FcitxTextFormatFlag : int {
@@ -29,6 +29,7 @@ void registerFcitxQtDBusTypes() {
     FCITX5_QT_DEFINE_DBUS_TYPE(FcitxQtAddonInfo);
     FCITX5_QT_DEFINE_DBUS_TYPE(FcitxQtAddonState);
     FCITX5_QT_DEFINE_DBUS_TYPE(FcitxQtAddonInfoV2);
+    FCITX5_QT_DEFINE_DBUS_TYPE(FcitxQtKeyFilterRule);
 }
 
 bool FcitxQtFormattedPreedit::operator==(
@@ -336,4 +337,43 @@ const QDBusArgument &operator>>(const QDBusArgument &argument,
     arg.setEnabled(enabled);
     return argument;
 }
+
+bool FcitxQtKeyFilterRule::matches(quint32 keyval, quint32 keyState) const {
+    return keyval >= first_ && keyval <= last_ &&
+           (keyState & stateMask_) == state_;
+}
+
+bool keyFilterMatches(const FcitxQtKeyFilterRuleList &rules, quint32 keyval,
+                      quint32 keyState) {
+    for (const auto &rule : rules) {
+        if (rule.matches(keyval, keyState)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+QDBusArgument &operator<<(QDBusArgument &argument,
+                          const FcitxQtKeyFilterRule &arg) {
+    argument.beginStructure();
+    argument << arg.first();
+    argument << arg.last();
+    argument << arg.stateMask();
+    argument << arg.state();
+    argument.endStructure();
+    return argument;
+}
+
+const QDBusArgument &operator>>(const QDBusArgument &argument,
+                                FcitxQtKeyFilterRule &arg) {
+    quint32 first, last, stateMask, state;
+    argument.beginStructure();
+    argument >> first >> last >> stateMask >> state;
+    argument.endStructure();
+    arg.setFirst(first);
+    arg.setLast(last);
+    arg.setStateMask(stateMask);
+    arg.setState(state);
+    return argument;
+}
 } // namespace fcitx
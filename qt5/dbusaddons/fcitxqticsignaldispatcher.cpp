@@ -0,0 +1,89 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "fcitxqticsignaldispatcher_p.h"
+#include "fcitxqtinputcontextproxy_p.h"
+
+namespace fcitx {
+
+namespace {
+
+QHash<QString, FcitxQtICSignalDispatcher *> &dispatchers() {
+    static QHash<QString, FcitxQtICSignalDispatcher *> dispatchers;
+    return dispatchers;
+}
+
+} // namespace
+
+FcitxQtICSignalDispatcher *
+FcitxQtICSignalDispatcher::get(const QDBusConnection &connection,
+                               const QString &service) {
+    const auto key = connection.name() + QLatin1Char('\n') + service;
+    auto *dispatcher = dispatchers().value(key);
+    // A peer to peer connection may be replaced by a new one with the same
+    // name, the old dispatcher lives on until its proxies are gone.
+    if (!dispatcher || !dispatcher->connection_.isConnected()) {
+        dispatcher = new FcitxQtICSignalDispatcher(connection, service, key);
+        dispatchers()[key] = dispatcher;
+    }
+    return dispatcher;
+}
+
+FcitxQtICSignalDispatcher::FcitxQtICSignalDispatcher(
+    const QDBusConnection &connection, const QString &service,
+    const QString &key)
+    : connection_(connection), service_(service), key_(key) {
+    // No member and no path, so a single match rule covers all signals of all
+    // input contexts. The rule is still limited to the input context
+    // interface of service, and fcitx sends these signals to the client that
+    // owns the input context only, so nothing of other clients arrives here.
+    // A path_namespace rule added with AddMatch would not help: QtDBus only
+    // delivers signals to its own hooks, whose paths are matched exactly,
+    // and this hook would add the same rule without a path anyway.
+    connection_.connect(
+        service_, QString(),
+        FcitxQtInputContextProxyPrivate::inputContextInterface(), QString(),
+        this, SLOT(dispatch(QDBusMessage)));
+}
+
+FcitxQtICSignalDispatcher::~FcitxQtICSignalDispatcher() {
+    connection_.disconnect(
+        service_, QString(),
+        FcitxQtInputContextProxyPrivate::inputContextInterface(), QString(),
+        this, SLOT(dispatch(QDBusMessage)));
+}
+
+void FcitxQtICSignalDispatcher::add(const QString &path,
+                                    FcitxQtInputContextProxyPrivate *proxy) {
+    proxies_[path] = proxy;
+}
+
+void FcitxQtICSignalDispatcher::remove(
+    const QString &path, FcitxQtInputContextProxyPrivate *proxy) {
+    auto iter = proxies_.find(path);
+    if (iter != proxies_.end() && iter.value() == proxy) {
+        proxies_.erase(iter);
+    }
+    if (!proxies_.isEmpty()) {
+        return;
+    }
+    auto &all = dispatchers();
+    auto self = all.find(key_);
+    if (self != all.end() && self.value() == this) {
+        all.erase(self);
+    }
+    // May be called from within dispatch().
+    deleteLater();
+}
+
+void FcitxQtICSignalDispatcher::dispatch(const QDBusMessage &message) {
+    if (auto *proxy = proxies_.value(message.path())) {
+        proxy->handleSignal(message);
+    }
+}
+
+} // namespace fcitx
@@ -11,7 +11,7 @@
 #include <QDBusInterface>
 #include <QDBusMetaType>
 #include <QFileInfo>
-#include <QTimer>
+#include <QMetaMethod>
 
 namespace fcitx {
 
@@ -39,24 +39,76 @@ bool FcitxQtInputContextProxy::isValid() const {
 
 QDBusPendingReply<> FcitxQtInputContextProxy::focusIn() {
     Q_D(FcitxQtInputContextProxy);
-    return d->icproxy_->FocusIn();
+    return d->asyncCall(QStringLiteral("FocusIn"));
 }
 
 QDBusPendingReply<> FcitxQtInputContextProxy::focusOut() {
     Q_D(FcitxQtInputContextProxy);
-    return d->icproxy_->FocusOut();
+    return d->asyncCall(QStringLiteral("FocusOut"));
 }
 
 QDBusPendingReply<bool> FcitxQtInputContextProxy::processKeyEvent(
     unsigned int keyval, unsigned int keycode, unsigned int state, bool type,
     unsigned int time) {
     Q_D(FcitxQtInputContextProxy);
-    return d->icproxy_->ProcessKeyEvent(keyval, keycode, state, type, time);
+    return d->asyncCall(QStringLiteral("ProcessKeyEvent"), keyval, keycode,
+                        state, type, time);
+}
+
+bool FcitxQtInputContextProxy::processKeyEvent(
+    unsigned int keyval, unsigned int keycode, unsigned int state, bool type,
+    unsigned int time, QObject *receiver, const char *returnMethod,
+    const char *errorMethod) {
+    Q_D(FcitxQtInputContextProxy);
+    return d->icConnection_.callWithCallback(
+        d->reusedMethodCall(QStringLiteral("ProcessKeyEvent"), keyval,
+                            keycode, state, type, time),
+        receiver, returnMethod, errorMethod);
+}
+
+QDBusMessage FcitxQtInputContextProxy::processKeyEventMessage(
+    unsigned int keyval, unsigned int keycode, unsigned int state, bool type,
+    unsigned int time) const {
+    Q_D(const FcitxQtInputContextProxy);
+    return d->methodCall(QStringLiteral("ProcessKeyEvent"), keyval, keycode,
+                         state, type, time);
+}
+
+QDBusPendingReply<bool> FcitxQtInputContextProxy::processKeyEventWithState(
+    const QVariantMap &changes, unsigned int keyval, unsigned int keycode,
+    unsigned int state, bool type, unsigned int time) {
+    Q_D(FcitxQtInputContextProxy);
+    return d->asyncCall(QStringLiteral("ProcessKeyEventWithState"), changes,
+                        keyval, keycode, state, type, time);
+}
+
+bool FcitxQtInputContextProxy::processKeyEventWithState(
+    const QVariantMap &changes, unsigned int keyval, unsigned int keycode,
+    unsigned int state, bool type, unsigned int time, QObject *receiver,
+    const char *returnMethod, const char *errorMethod) {
+    Q_D(FcitxQtInputContextProxy);
+    return d->icConnection_.callWithCallback(
+        d->reusedMethodCall(QStringLiteral("ProcessKeyEventWithState"),
+                            changes, keyval, keycode, state, type, time),
+        receiver, returnMethod, errorMethod);
+}
+
+QDBusMessage FcitxQtInputContextProxy::processKeyEventWithStateMessage(
+    const QVariantMap &changes, unsigned int keyval, unsigned int keycode,
+    unsigned int state, bool type, unsigned int time) const {
+    Q_D(const FcitxQtInputContextProxy);
+    return d->methodCall(QStringLiteral("ProcessKeyEventWithState"), changes,
+                         keyval, keycode, state, type, time);
+}
+
+QDBusConnection FcitxQtInputContextProxy::connection() const {
+    Q_D(const FcitxQtInputContextProxy);
+    return d->icConnection_;
 }
 
 QDBusPendingReply<> FcitxQtInputContextProxy::reset() {
     Q_D(FcitxQtInputContextProxy);
-    return d->icproxy_->Reset();
+    return d->asyncCall(QStringLiteral("Reset"));
 }
 
 QDBusPendingReply<>
@@ -67,33 +119,35 @@ FcitxQtInputContextProxy::setSupportedCapability(qulonglong caps) {
 
 QDBusPendingReply<> FcitxQtInputContextProxy::setCapability(qulonglong caps) {
     Q_D(FcitxQtInputContextProxy);
-    return d->icproxy_->SetCapability(caps);
+    return d->asyncCall(QStringLiteral("SetCapability"), caps);
 }
 
 QDBusPendingReply<> FcitxQtInputContextProxy::setCursorRect(int x, int y, int w,
                                                             int h) {
     Q_D(FcitxQtInputContextProxy);
-    return d->icproxy_->SetCursorRect(x, y, w, h);
+    return d->asyncCall(QStringLiteral("SetCursorRect"), x, y, w, h);
 }
 
 QDBusPendingReply<> FcitxQtInputContextProxy::setCursorRectV2(int x, int y,
                                                               int w, int h,
                                                               double scale) {
     Q_D(FcitxQtInputContextProxy);
-    return d->icproxy_->SetCursorRectV2(x, y, w, h, scale);
+    return d->asyncCall(QStringLiteral("SetCursorRectV2"), x, y, w, h, scale);
 }
 
 QDBusPendingReply<> FcitxQtInputContextProxy::setSurroundingText(
     const QString &text, unsigned int cursor, unsigned int anchor) {
     Q_D(FcitxQtInputContextProxy);
-    return d->icproxy_->SetSurroundingText(text, cursor, anchor);
+    return d->asyncCall(QStringLiteral("SetSurroundingText"), text, cursor,
+                        anchor);
 }
 
 QDBusPendingReply<>
 FcitxQtInputContextProxy::setSurroundingTextPosition(unsigned int cursor,
                                                      unsigned int anchor) {
     Q_D(FcitxQtInputContextProxy);
-    return d->icproxy_->SetSurroundingTextPosition(cursor, anchor);
+    return d->asyncCall(QStringLiteral("SetSurroundingTextPosition"), cursor,
+                        anchor);
 }
 
 QDBusPendingReply<> FcitxQtInputContextProxy::prevPage() {
@@ -117,9 +171,51 @@ QDBusPendingReply<> FcitxQtInputContextProxy::invokeAction(unsigned int action,
     return d->icproxy_->InvokeAction(action, cursor);
 }
 
+void FcitxQtInputContextProxy::clientSideUIMessage(
+    const QDBusMessage &message) {
+    if (message.signature() !=
+        QLatin1String("a(si)ia(si)a(si)a(ss)iibb")) {
+        return;
+    }
+    Q_EMIT updateClientSideUIMessage(message);
+    // Decoding every list is what the message signal saves, so only do it
+    // when someone listens.
+    static const QMetaMethod updateClientSideUISignal =
+        QMetaMethod::fromSignal(&FcitxQtInputContextProxy::updateClientSideUI);
+    if (isSignalConnected(updateClientSideUISignal)) {
+        const auto args = message.arguments();
+        Q_EMIT updateClientSideUI(
+            qdbus_cast<FcitxQtFormattedPreeditList>(args[0]), args[1].toInt(),
+            qdbus_cast<FcitxQtFormattedPreeditList>(args[2]),
+            qdbus_cast<FcitxQtFormattedPreeditList>(args[3]),
+            qdbus_cast<FcitxQtStringKeyValueList>(args[4]), args[5].toInt(),
+            args[6].toInt(), args[7].toBool(), args[8].toBool());
+    }
+}
+
 bool FcitxQtInputContextProxy::supportInvokeAction() const {
     Q_D(const FcitxQtInputContextProxy);
-    return d->supportInvokeAction_;
+    return d->hasFeature(FcitxQtWatcher::InvokeActionFeature);
+}
+
+bool FcitxQtInputContextProxy::supportKeyFilter() const {
+    Q_D(const FcitxQtInputContextProxy);
+    return d->hasFeature(FcitxQtWatcher::KeyFilterFeature);
+}
+
+bool FcitxQtInputContextProxy::supportProcessKeyEventWithState() const {
+    Q_D(const FcitxQtInputContextProxy);
+    return d->hasFeature(FcitxQtWatcher::ProcessKeyEventWithStateFeature);
+}
+
+bool FcitxQtInputContextProxy::wantsKey(unsigned int keyval,
+                                        unsigned int state) const {
+    Q_D(const FcitxQtInputContextProxy);
+    if (!d->keyFilterEnabled_ ||
+        !d->hasFeature(FcitxQtWatcher::KeyFilterFeature)) {
+        return true;
+    }
+    return keyFilterMatches(d->keyFilter_, keyval, state);
 }
 
 } // namespace fcitx
@@ -7,10 +7,13 @@
 #ifndef _DBUSADDONS_FCITXQTINPUTCONTEXTPROXY_P_H_
 #define _DBUSADDONS_FCITXQTINPUTCONTEXTPROXY_P_H_
 
+#include "fcitxqticsignaldispatcher_p.h"
 #include "fcitxqtinputcontextproxy.h"
 #include "fcitxqtinputcontextproxyimpl.h"
 #include "fcitxqtinputmethodproxy.h"
 #include "fcitxqtwatcher.h"
+#include <QDBusMessage>
+#include <QHash>
 #include <QDBusServiceWatcher>
 
 namespace fcitx {
@@ -23,6 +26,8 @@ public:
         registerFcitxQtDBusTypes();
         QObject::connect(fcitxWatcher_, &FcitxQtWatcher::availabilityChanged, q,
                          [this]() { availabilityChanged(); });
+        QObject::connect(fcitxWatcher_, &FcitxQtWatcher::reconnectRequested,
+                         q, [this]() { recheck(); });
         watcher_.setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
         QObject::connect(&watcher_, &QDBusServiceWatcher::serviceUnregistered,
                          q, [this]() {
@@ -36,16 +41,20 @@ public:
         if (isValid()) {
             icproxy_->DestroyIC();
         }
+        if (dispatcher_) {
+            dispatcher_->remove(icPath_, this);
+        }
     }
 
     bool isValid() const { return (icproxy_ && icproxy_->isValid()); }
 
-    void availabilityChanged() {
-        QTimer::singleShot(100, q_ptr, [this]() { recheck(); });
-    }
+    // Input contexts are created again in batches scheduled by the watcher,
+    // so they don't all hit fcitx at once.
+    void availabilityChanged() { fcitxWatcher_->scheduleReconnect(); }
 
     void recheck() {
-        if (!isValid() && fcitxWatcher_->availability()) {
+        if (!isValid() && !createInputContextWatcher_ &&
+            fcitxWatcher_->availability()) {
             createInputContext();
         }
         if (!fcitxWatcher_->availability()) {
@@ -61,13 +70,20 @@ public:
 
         delete improxy_;
         improxy_ = nullptr;
+        if (dispatcher_) {
+            dispatcher_->remove(icPath_, this);
+            dispatcher_ = nullptr;
+        }
         delete icproxy_;
         icproxy_ = nullptr;
+        icService_.clear();
+        icPath_.clear();
+        icConnection_ = QDBusConnection(QString());
+        methodCalls_.clear();
         delete createInputContextWatcher_;
         createInputContextWatcher_ = nullptr;
-        delete introspectWatcher_;
-        introspectWatcher_ = nullptr;
-        supportInvokeAction_ = false;
+        keyFilterEnabled_ = false;
+        keyFilter_.clear();
     }
 
     void createInputContext() {
@@ -78,20 +94,25 @@ public:
 
         cleanUp();
 
-        auto service = fcitxWatcher_->serviceName();
         auto connection = fcitxWatcher_->connection();
 
-        auto owner = connection.interface()->serviceOwner(service);
-        if (!owner.isValid()) {
-            return;
-        }
+        QString owner;
+        if (fcitxWatcher_->isPeerToPeerConnected()) {
+            // There is no bus name on a peer to peer connection, and
+            // fcitxWatcher_ drops it once the owner is gone from the bus.
+            connection = fcitxWatcher_->inputContextConnection();
+        } else {
+            // fcitxWatcher_ follows the owner, so the bus is not asked here.
+            owner = fcitxWatcher_->serviceOwner();
+            if (owner.isEmpty()) {
+                fcitxWatcher_->reconnectFinished(false);
+                return;
+            }
 
-        watcher_.setConnection(connection);
-        watcher_.setWatchedServices(QStringList() << owner);
-        // Avoid race, query again.
-        if (!connection.interface()->isServiceRegistered(owner)) {
-            cleanUp();
-            return;
+            watcher_.setConnection(connection);
+            watcher_.setWatchedServices(QStringList() << owner);
+            // If the owner is gone before the watch is in place,
+            // CreateInputContext fails and is tried again.
         }
 
         QFileInfo info(QCoreApplication::applicationFilePath());
@@ -136,67 +157,115 @@ public:
         Q_Q(FcitxQtInputContextProxy);
         if (createInputContextWatcher_->isError()) {
             cleanUp();
+            fcitxWatcher_->reconnectFinished(false);
             return;
         }
+        fcitxWatcher_->reconnectFinished(true);
 
         QDBusPendingReply<QDBusObjectPath, QByteArray> reply(
             *createInputContextWatcher_);
         icproxy_ = new FcitxQtInputContextProxyImpl(improxy_->service(),
                                                     reply.value().path(),
                                                     improxy_->connection(), q);
-        QObject::connect(icproxy_, &FcitxQtInputContextProxyImpl::CommitString,
-                         q, &FcitxQtInputContextProxy::commitString);
-        QObject::connect(icproxy_, &FcitxQtInputContextProxyImpl::CurrentIM, q,
-                         &FcitxQtInputContextProxy::currentIM);
-        QObject::connect(icproxy_,
-                         &FcitxQtInputContextProxyImpl::DeleteSurroundingText,
-                         q, &FcitxQtInputContextProxy::deleteSurroundingText);
-        QObject::connect(icproxy_, &FcitxQtInputContextProxyImpl::ForwardKey, q,
-                         &FcitxQtInputContextProxy::forwardKey);
-        QObject::connect(icproxy_,
-                         &FcitxQtInputContextProxyImpl::UpdateFormattedPreedit,
-                         q, &FcitxQtInputContextProxy::updateFormattedPreedit);
-        QObject::connect(icproxy_,
-                         &FcitxQtInputContextProxyImpl::UpdateClientSideUI, q,
-                         &FcitxQtInputContextProxy::updateClientSideUI);
-        QObject::connect(icproxy_,
-                         &FcitxQtInputContextProxyImpl::NotifyFocusOut, q,
-                         &FcitxQtInputContextProxy::notifyFocusOut);
+        icService_ = icproxy_->service();
+        icPath_ = icproxy_->path();
+        icConnection_ = icproxy_->connection();
+        methodCalls_.clear();
+        // Signals come through the dispatcher shared by all input contexts,
+        // instead of a match rule per signal of icproxy_.
+        dispatcher_ = FcitxQtICSignalDispatcher::get(icConnection_, icService_);
+        dispatcher_->add(icPath_, this);
 
         delete createInputContextWatcher_;
         createInputContextWatcher_ = nullptr;
         Q_EMIT q->inputContextCreated(reply.argumentAt<1>());
 
-        introspect();
+        // Only the first input context of a fcitx instance asks for its
+        // features, the others use what the watcher has cached.
+        fcitxWatcher_->detectFeatures(icService_, icPath_);
     }
 
-    void introspect() {
+    bool hasFeature(FcitxQtWatcher::Feature feature) const {
+        return isValid() &&
+               fcitxWatcher_->features(icService_).testFlag(feature);
+    }
+
+    void handleSignal(const QDBusMessage &message) {
         Q_Q(FcitxQtInputContextProxy);
-        if (introspectWatcher_) {
-            delete introspectWatcher_;
-            introspectWatcher_ = nullptr;
+        const auto &member = message.member();
+        const auto &signature = message.signature();
+        const auto args = message.arguments();
+        if (member == QLatin1String("CommitString") &&
+            signature == QLatin1String("s")) {
+            Q_EMIT q->commitString(args[0].toString());
+        } else if (member == QLatin1String("CurrentIM") &&
+                   signature == QLatin1String("sss")) {
+            Q_EMIT q->currentIM(args[0].toString(), args[1].toString(),
+                                args[2].toString());
+        } else if (member == QLatin1String("DeleteSurroundingText") &&
+                   signature == QLatin1String("iu")) {
+            Q_EMIT q->deleteSurroundingText(args[0].toInt(), args[1].toUInt());
+        } else if (member == QLatin1String("ForwardKey") &&
+                   signature == QLatin1String("uub")) {
+            Q_EMIT q->forwardKey(args[0].toUInt(), args[1].toUInt(),
+                                 args[2].toBool());
+        } else if (member == QLatin1String("UpdateFormattedPreedit") &&
+                   signature == QLatin1String("a(si)i")) {
+            Q_EMIT q->updateFormattedPreedit(
+                qdbus_cast<FcitxQtFormattedPreeditList>(args[0]),
+                args[1].toInt());
+        } else if (member == QLatin1String("UpdateClientSideUI")) {
+            q->clientSideUIMessage(message);
+        } else if (member == QLatin1String("UpdateClientSideUIHighlight") &&
+                   signature == QLatin1String("ii")) {
+            Q_EMIT q->updateClientSideUIHighlight(args[0].toInt(),
+                                                  args[1].toInt());
+        } else if (member == QLatin1String("NotifyFocusOut")) {
+            Q_EMIT q->notifyFocusOut();
+        } else if (member == QLatin1String("UpdateKeyFilter") &&
+                   signature == QLatin1String("ba(uuuu)")) {
+            keyFilterEnabled_ = args[0].toBool();
+            keyFilter_ = qdbus_cast<FcitxQtKeyFilterRuleList>(args[1]);
         }
-        QDBusMessage call = QDBusMessage::createMethodCall(
-            icproxy_->service(), icproxy_->path(),
-            "org.freedesktop.DBus.Introspectable", "Introspect");
-
-        introspectWatcher_ = new QDBusPendingCallWatcher(
-            fcitxWatcher_->connection().asyncCall(call));
-        QObject::connect(introspectWatcher_, &QDBusPendingCallWatcher::finished,
-                         q, [this]() { introspectFinished(); });
     }
 
-    void introspectFinished() {
-        if (introspectWatcher_->isFinished() &&
-            !introspectWatcher_->isError()) {
-            QDBusPendingReply<QString> reply = *introspectWatcher_;
+    static QString inputContextInterface() {
+        return QStringLiteral("org.fcitx.Fcitx.InputContext1");
+    }
 
-            if (reply.value().contains("InvokeAction")) {
-                supportInvokeAction_ = true;
-            }
+    // Calls of the frequent methods are built here instead of going through
+    // the generated proxy, which copies the target out of the proxy and
+    // grows an argument list on every call. The arguments still go through
+    // QVariant, QtDBus has no public way to append typed ones to a message.
+    template <typename... Args>
+    QDBusMessage methodCall(const QString &member,
+                            const Args &...args) const {
+        auto message = QDBusMessage::createMethodCall(
+            icService_, icPath_, inputContextInterface(), member);
+        message.setArguments({QVariant::fromValue(args)...});
+        return message;
+    }
+
+    // Same as above for a call that is sent right away. The message of each
+    // method is built and validated once per input context, and only its
+    // arguments are replaced. That is fine since QtDBus converts the message
+    // when it's sent, but copies of a QDBusMessage share their data, so one
+    // that is handed out must come from methodCall instead.
+    template <typename... Args>
+    const QDBusMessage &reusedMethodCall(const QString &member,
+                                         const Args &...args) {
+        auto &message = methodCalls_[member];
+        if (message.type() == QDBusMessage::InvalidMessage) {
+            message = QDBusMessage::createMethodCall(
+                icService_, icPath_, inputContextInterface(), member);
         }
-        delete introspectWatcher_;
-        introspectWatcher_ = nullptr;
+        message.setArguments({QVariant::fromValue(args)...});
+        return message;
+    }
+
+    template <typename... Args>
+    QDBusPendingCall asyncCall(const QString &member, const Args &...args) {
+        return icConnection_.asyncCall(reusedMethodCall(member, args...));
     }
 
     FcitxQtInputContextProxy *q_ptr;
@@ -206,9 +275,16 @@ public:
     QDBusServiceWatcher watcher_;
     FcitxQtInputMethodProxy *improxy_ = nullptr;
     FcitxQtInputContextProxyImpl *icproxy_ = nullptr;
-    bool supportInvokeAction_ = false;
+    // Target of the input context, set along with icproxy_.
+    QString icService_;
+    QString icPath_;
+    QDBusConnection icConnection_{QString()};
+    // Member to message, see reusedMethodCall.
+    QHash<QString, QDBusMessage> methodCalls_;
+    FcitxQtICSignalDispatcher *dispatcher_ = nullptr;
+    bool keyFilterEnabled_ = false;
+    FcitxQtKeyFilterRuleList keyFilter_;
     QDBusPendingCallWatcher *createInputContextWatcher_ = nullptr;
-    QDBusPendingCallWatcher *introspectWatcher_ = nullptr;
     QString display_;
     bool portal_ = false;
 };
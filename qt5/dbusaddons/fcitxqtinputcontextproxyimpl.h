@@ -88,6 +88,13 @@ public Q_SLOTS: // METHODS
         return asyncCallWithArgumentList(QStringLiteral("ProcessKeyEvent"), argumentList);
     }
 
+    inline QDBusPendingReply<bool> ProcessKeyEventWithState(const QVariantMap &changes, unsigned int keyval, unsigned int keycode, unsigned int state, bool type, unsigned int time)
+    {
+        QList<QVariant> argumentList;
+        argumentList << QVariant::fromValue(changes) << QVariant::fromValue(keyval) << QVariant::fromValue(keycode) << QVariant::fromValue(state) << QVariant::fromValue(type) << QVariant::fromValue(time);
+        return asyncCallWithArgumentList(QStringLiteral("ProcessKeyEventWithState"), argumentList);
+    }
+
     inline QDBusPendingReply<> Reset()
     {
         QList<QVariant> argumentList;
@@ -151,7 +158,9 @@ Q_SIGNALS: // SIGNALS
     void ForwardKey(unsigned int keyval, unsigned int state, bool type);
     void NotifyFocusOut();
     void UpdateClientSideUI(FcitxQtFormattedPreeditList preedit, int cursorpos, FcitxQtFormattedPreeditList auxUp, FcitxQtFormattedPreeditList auxDown, FcitxQtStringKeyValueList candidates, int candidateIndex, int layoutHint, bool hasPrev, bool hasNext);
+    void UpdateClientSideUIHighlight(int candidateIndex, int cursorpos);
     void UpdateFormattedPreedit(FcitxQtFormattedPreeditList str, int cursorpos);
+    void UpdateKeyFilter(bool enabled, FcitxQtKeyFilterRuleList rules);
 };
 
 }
@@ -59,6 +59,12 @@ public Q_SLOTS: // METHODS
         return reply;
     }
 
+    inline QDBusPendingReply<QString> GetPeerToPeerAddress()
+    {
+        QList<QVariant> argumentList;
+        return asyncCallWithArgumentList(QStringLiteral("GetPeerToPeerAddress"), argumentList);
+    }
+
 Q_SIGNALS: // SIGNALS
 };
 
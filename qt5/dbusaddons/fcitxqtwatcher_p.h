@@ -9,7 +9,10 @@
 #define _DBUSADDONS_FCITXQTWATCHER_P_H_
 
 #include "fcitxqtwatcher.h"
+#include <QDBusPendingCallWatcher>
 #include <QDBusServiceWatcher>
+#include <QHash>
+#include <QTimer>
 
 #define FCITX_MAIN_SERVICE_NAME "org.fcitx.Fcitx5"
 #define FCITX_PORTAL_SERVICE_NAME "org.freedesktop.portal.Fcitx"
@@ -18,14 +21,72 @@ namespace fcitx {
 
 class FcitxQtWatcherPrivate {
 public:
-    FcitxQtWatcherPrivate(FcitxQtWatcher *q) : serviceWatcher_(q) {}
+    FcitxQtWatcherPrivate(FcitxQtWatcher *q)
+        : serviceWatcher_(q),
+          peerConnectionName_(
+              QStringLiteral("fcitx-peer-%1")
+                  .arg(reinterpret_cast<quintptr>(q), 0, 16)) {
+        reconnectTimer_.setSingleShot(true);
+    }
+
+    void resetPeer() {
+        delete peerAddressWatcher_;
+        peerAddressWatcher_ = nullptr;
+        if (peerConnected_) {
+            QDBusConnection::disconnectFromPeer(peerConnectionName_);
+        }
+        peerConnected_ = false;
+        peerResolved_ = false;
+        peerService_.clear();
+        // Features over the peer to peer connection are keyed by empty name.
+        resetFeatures(QString());
+    }
+
+    void setOwner(const QString &service, const QString &owner) {
+        if (service == QLatin1String(FCITX_MAIN_SERVICE_NAME)) {
+            mainOwner_ = owner;
+        } else if (service == QLatin1String(FCITX_PORTAL_SERVICE_NAME)) {
+            portalOwner_ = owner;
+        }
+    }
+
+    void resetOwnerQueries() {
+        qDeleteAll(ownerQueries_);
+        ownerQueries_.clear();
+    }
+
+    void resetFeatures(const QString &uniqueName) {
+        features_.remove(uniqueName);
+        delete featureWatchers_.take(uniqueName);
+    }
 
     QDBusServiceWatcher serviceWatcher_;
     bool watchPortal_ = false;
     bool availability_ = false;
-    bool mainPresent_ = false;
-    bool portalPresent_ = false;
+    // Unique names of the owners, empty if not present.
+    QString mainOwner_;
+    QString portalOwner_;
+    // Pending GetNameOwner by service, dropped once NameOwnerChanged of the
+    // service arrives, which is newer.
+    QHash<QString, QDBusPendingCallWatcher *> ownerQueries_;
     bool watched_ = false;
+    bool peerToPeer_ = false;
+    // Set once the peer address request finished, whether it succeeded or
+    // not.
+    bool peerResolved_ = false;
+    bool peerConnected_ = false;
+    QString peerConnectionName_;
+    // The service the peer address is requested from.
+    QString peerService_;
+    QDBusPendingCallWatcher *peerAddressWatcher_ = nullptr;
+    // Detected features and pending detections, by unique name of fcitx.
+    QHash<QString, FcitxQtWatcher::Features> features_;
+    QHash<QString, QDBusPendingCallWatcher *> featureWatchers_;
+    QTimer reconnectTimer_;
+    // Failed batches of input context creation in a row.
+    int reconnectFailures_ = 0;
+    // Set when fcitx shows up, so the next batch is spread.
+    bool reconnectJitter_ = false;
 };
 } // namespace fcitx
 
@@ -0,0 +1,152 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "clientsideuiview.h"
+#include <QDBusArgument>
+
+namespace fcitx {
+
+namespace {
+
+constexpr int preeditArgument = 0;
+constexpr int cursorArgument = 1;
+constexpr int auxUpArgument = 2;
+constexpr int auxDownArgument = 3;
+constexpr int candidatesArgument = 4;
+constexpr int candidateIndexArgument = 5;
+constexpr int layoutHintArgument = 6;
+constexpr int hasPrevArgument = 7;
+constexpr int hasNextArgument = 8;
+constexpr int argumentCount = 9;
+
+// 64-bit FNV-1a.
+class Fingerprint {
+public:
+    void add(const void *data, size_t size) {
+        const auto *bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; i++) {
+            value_ = (value_ ^ bytes[i]) * 0x100000001b3ull;
+        }
+    }
+    void add(qint32 value) { add(&value, sizeof(value)); }
+    void add(const QString &str) {
+        // The length keeps ("ab", "c") apart from ("a", "bc").
+        add(static_cast<qint32>(str.size()));
+        add(str.constData(), str.size() * sizeof(QChar));
+    }
+
+    quint64 value() const { return value_; }
+
+private:
+    quint64 value_ = 0xcbf29ce484222325ull;
+};
+
+int argumentIndex(ClientSideUIView::Section section) {
+    switch (section) {
+    case ClientSideUIView::Section::Preedit:
+        return preeditArgument;
+    case ClientSideUIView::Section::AuxUp:
+        return auxUpArgument;
+    case ClientSideUIView::Section::AuxDown:
+        return auxDownArgument;
+    case ClientSideUIView::Section::Candidates:
+        break;
+    }
+    return candidatesArgument;
+}
+
+} // namespace
+
+ClientSideUIView::ClientSideUIView(const QDBusMessage &message)
+    : arguments_(message.arguments()),
+      valid_(arguments_.size() == argumentCount &&
+             message.signature() ==
+                 QLatin1String("a(si)ia(si)a(si)a(ss)iibb")) {}
+
+void ClientSideUIView::decode(Section section) {
+    const auto index = static_cast<size_t>(section);
+    if (decoded_[index]) {
+        return;
+    }
+    decoded_[index] = true;
+
+    Fingerprint fingerprint;
+    const int argument = argumentIndex(section);
+    if (section == Section::Candidates) {
+        if (valid_) {
+            candidates_ = qdbus_cast<FcitxQtStringKeyValueList>(
+                arguments_.at(argument));
+        }
+        const auto &candidates = candidates_;
+        for (const auto &candidate : candidates) {
+            fingerprint.add(candidate.key());
+            fingerprint.add(candidate.value());
+        }
+    } else {
+        if (valid_) {
+            texts_[index] = qdbus_cast<FcitxQtFormattedPreeditList>(
+                arguments_.at(argument));
+        }
+        const auto &text = texts_[index];
+        for (const auto &preedit : text) {
+            fingerprint.add(preedit.string());
+            fingerprint.add(preedit.format());
+        }
+    }
+    fingerprints_[index] = fingerprint.value();
+    if (valid_) {
+        // Drop the reference to the message data once it is read.
+        arguments_[argument] = QVariant();
+    }
+}
+
+int ClientSideUIView::intAt(int index) const {
+    return valid_ ? arguments_.at(index).toInt() : 0;
+}
+
+bool ClientSideUIView::boolAt(int index) const {
+    return valid_ ? arguments_.at(index).toBool() : false;
+}
+
+const FcitxQtFormattedPreeditList &ClientSideUIView::preedit() {
+    decode(Section::Preedit);
+    return texts_[static_cast<size_t>(Section::Preedit)];
+}
+
+int ClientSideUIView::cursor() const { return intAt(cursorArgument); }
+
+const FcitxQtFormattedPreeditList &ClientSideUIView::auxUp() {
+    decode(Section::AuxUp);
+    return texts_[static_cast<size_t>(Section::AuxUp)];
+}
+
+const FcitxQtFormattedPreeditList &ClientSideUIView::auxDown() {
+    decode(Section::AuxDown);
+    return texts_[static_cast<size_t>(Section::AuxDown)];
+}
+
+const FcitxQtStringKeyValueList &ClientSideUIView::candidates() {
+    decode(Section::Candidates);
+    return candidates_;
+}
+
+int ClientSideUIView::candidateIndex() const {
+    return intAt(candidateIndexArgument);
+}
+
+int ClientSideUIView::layoutHint() const { return intAt(layoutHintArgument); }
+
+bool ClientSideUIView::hasPrev() const { return boolAt(hasPrevArgument); }
+
+bool ClientSideUIView::hasNext() const { return boolAt(hasNextArgument); }
+
+quint64 ClientSideUIView::fingerprint(Section section) {
+    decode(section);
+    return fingerprints_[static_cast<size_t>(section)];
+}
+
+} // namespace fcitx
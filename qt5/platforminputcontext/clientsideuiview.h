@@ -0,0 +1,64 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+#ifndef _PLATFORMINPUTCONTEXT_CLIENTSIDEUIVIEW_H_
+#define _PLATFORMINPUTCONTEXT_CLIENTSIDEUIVIEW_H_
+
+#include "fcitxqtdbustypes.h"
+#include <QDBusMessage>
+#include <QVariantList>
+#include <array>
+
+namespace fcitx {
+
+// The arguments of an UpdateClientSideUI signal. Each list is only decoded
+// from the message when it is first read, so nothing is decoded for an update
+// that is dropped. Reading a list decodes it, hence those accessors are not
+// const.
+class ClientSideUIView {
+public:
+    enum class Section { Preedit, AuxUp, AuxDown, Candidates };
+
+    explicit ClientSideUIView(const QDBusMessage &message);
+    Q_DISABLE_COPY(ClientSideUIView)
+
+    // An invalid view has all sections empty.
+    bool isValid() const { return valid_; }
+
+    const FcitxQtFormattedPreeditList &preedit();
+    int cursor() const;
+    const FcitxQtFormattedPreeditList &auxUp();
+    const FcitxQtFormattedPreeditList &auxDown();
+    const FcitxQtStringKeyValueList &candidates();
+    int candidateIndex() const;
+    int layoutHint() const;
+    bool hasPrev() const;
+    bool hasNext() const;
+
+    // A hash of the content of section, taken while it is decoded. If a
+    // section has the same fingerprint as in the last update, what is built
+    // from it, e.g. text layouts, may be kept.
+    quint64 fingerprint(Section section);
+
+private:
+    void decode(Section section);
+    int intAt(int index) const;
+    bool boolAt(int index) const;
+
+    // Arrays of structures are kept as QDBusArgument by QtDBus.
+    QVariantList arguments_;
+    bool valid_ = false;
+    // Indexed by Section.
+    std::array<bool, 4> decoded_{};
+    std::array<quint64, 4> fingerprints_{};
+    // Preedit, aux up and aux down.
+    std::array<FcitxQtFormattedPreeditList, 3> texts_;
+    FcitxQtStringKeyValueList candidates_;
+};
+
+} // namespace fcitx
+
+#endif // _PLATFORMINPUTCONTEXT_CLIENTSIDEUIVIEW_H_
@@ -0,0 +1,510 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+#include "composecache.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <map>
+#include <optional>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace fcitx {
+
+namespace {
+
+constexpr char cacheMagic[8] = {'F', 'Q', 'T', 'C', 'O', 'M', 'P', '\0'};
+// Bump whenever the layout changes. Also tells a cache of another byte order
+// apart, since it's never written in anything but the native one.
+constexpr quint32 cacheVersion = 1;
+
+// Same as the one of xkbcommon, which is not public.
+bool isModifier(quint32 keysym) {
+    return (keysym >= XKB_KEY_Shift_L && keysym <= XKB_KEY_Hyper_R) ||
+           (keysym >= XKB_KEY_ISO_Lock && keysym <= XKB_KEY_ISO_Level5_Lock) ||
+           keysym == XKB_KEY_Mode_switch || keysym == XKB_KEY_Num_Lock;
+}
+
+QString envPath(const char *name, const QString &defaultValue = QString()) {
+    const QByteArray value = qgetenv(name);
+    return value.isEmpty() ? defaultValue : QFile::decodeName(value);
+}
+
+// Where xkbcommon looks for Compose files.
+struct ComposePaths {
+    QString home;
+    QString localeDir;
+    // Compose file of the locale, empty if there is none.
+    QString localeFile;
+};
+
+// Looks name up in a file of the X locale directory, the same way as
+// xkbcommon. Each line maps a left value, optionally followed by a colon, to
+// a right one. Returns the value on the other side of the first line that
+// has name on the left, or on the right if leftToRight is false.
+QString resolveName(const QString &localeDir, const QString &fileName,
+                    const QString &name, bool leftToRight) {
+    QFile file(localeDir + QLatin1Char('/') + fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+    const QByteArray target = QFile::encodeName(name);
+    while (!file.atEnd()) {
+        // e.g. "en_US.UTF-8/Compose:		en_US.UTF-8"
+        const QByteArray line = file.readLine().simplified();
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+        int end = 0;
+        while (end < line.size() && line[end] != ' ' && line[end] != ':') {
+            end++;
+        }
+        const QByteArray left = line.left(end);
+        QByteArray rest = line.mid(end);
+        if (rest.startsWith(':')) {
+            rest.remove(0, 1);
+        }
+        rest = rest.trimmed();
+        if (left.isEmpty() || rest.isEmpty()) {
+            continue;
+        }
+        const QByteArray right = rest.split(' ').first();
+        if ((leftToRight ? left : right) == target) {
+            return QFile::decodeName(leftToRight ? right : left);
+        }
+    }
+    return QString();
+}
+
+// Expands the path of an include line, empty if xkbcommon would fail to or
+// it's not an absolute path.
+QString includePath(const QByteArray &value, const ComposePaths &paths) {
+    QString result;
+    const QString path = QFile::decodeName(value);
+    for (int i = 0; i < path.size(); i++) {
+        if (path[i] != QLatin1Char('%')) {
+            result += path[i];
+            continue;
+        }
+        if (++i == path.size()) {
+            return QString();
+        }
+        switch (path[i].unicode()) {
+        case '%':
+            result += QLatin1Char('%');
+            break;
+        case 'H':
+            if (paths.home.isEmpty()) {
+                return QString();
+            }
+            result += paths.home;
+            break;
+        case 'L':
+            if (paths.localeFile.isEmpty()) {
+                return QString();
+            }
+            result += paths.localeFile;
+            break;
+        case 'S':
+            result += paths.localeDir;
+            break;
+        default:
+            return QString();
+        }
+    }
+    return result.startsWith(QLatin1Char('/')) ? result : QString();
+}
+
+// Adds path and every file it includes to files. Returns false if the files
+// xkbcommon reads for it can't be told, e.g. for an include this does not
+// understand.
+bool addComposeFile(const QString &path, const ComposePaths &paths,
+                    int depth, QStringList &files) {
+    // Same limit as xkbcommon, which fails beyond it.
+    constexpr int maxIncludeDepth = 5;
+    QFile file(path);
+    if (depth > maxIncludeDepth || !file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    files << path;
+    while (!file.atEnd()) {
+        // e.g. include "%L"
+        const QByteArray line = file.readLine().trimmed();
+        if (!line.startsWith("include") ||
+            (line.size() > 7 && line[7] != ' ' && line[7] != '\t' &&
+             line[7] != '"')) {
+            continue;
+        }
+        const QByteArray value = line.mid(7).trimmed();
+        const int close = value.indexOf('"', 1);
+        if (!value.startsWith('"') || close < 0) {
+            return false;
+        }
+        const QByteArray include = value.mid(1, close - 1);
+        // Escapes are left to xkbcommon.
+        if (include.contains('\\')) {
+            return false;
+        }
+        const QString included = includePath(include, paths);
+        if (included.isEmpty() ||
+            !addComposeFile(included, paths, depth + 1, files)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Files that xkbcommon reads to compile the table of locale, along with the
+// ones that would be used instead if they appeared. Nothing if that can't be
+// told, the table is never cached then.
+std::optional<QStringList> composeFiles(const QString &locale) {
+    ComposePaths paths;
+    paths.home = envPath("HOME");
+    paths.localeDir =
+        envPath("XLOCALEDIR", QStringLiteral("/usr/share/X11/locale"));
+    QStringList files;
+    files << paths.localeDir + QStringLiteral("/locale.alias")
+          << paths.localeDir + QStringLiteral("/compose.dir");
+
+    QString resolved = resolveName(
+        paths.localeDir, QStringLiteral("locale.alias"), locale, true);
+    if (resolved.isEmpty()) {
+        resolved = locale;
+    }
+    if (resolved == QLatin1String("C")) {
+        resolved = QStringLiteral("en_US.UTF-8");
+    }
+    const QString localeFile = resolveName(
+        paths.localeDir, QStringLiteral("compose.dir"), resolved, false);
+    if (!localeFile.isEmpty()) {
+        paths.localeFile = localeFile.startsWith(QLatin1Char('/'))
+                               ? localeFile
+                               : paths.localeDir + QLatin1Char('/') +
+                                     localeFile;
+    }
+
+    // The first of these that can be read replaces the one of the locale.
+    QStringList userFiles;
+    const QString composeFile = envPath("XCOMPOSEFILE");
+    if (!composeFile.isEmpty()) {
+        userFiles << composeFile;
+    }
+    const QString configHome = envPath("XDG_CONFIG_HOME");
+    if (configHome.startsWith(QLatin1Char('/'))) {
+        userFiles << configHome + QStringLiteral("/XCompose");
+    } else if (!paths.home.isEmpty()) {
+        userFiles << paths.home + QStringLiteral("/.config/XCompose");
+    }
+    if (!paths.home.isEmpty()) {
+        userFiles << paths.home + QStringLiteral("/.XCompose");
+    }
+    for (const auto &userFile : userFiles) {
+        if (QFile(userFile).open(QIODevice::ReadOnly)) {
+            if (!addComposeFile(userFile, paths, 0, files)) {
+                return std::nullopt;
+            }
+            return files;
+        }
+        files << userFile;
+    }
+    if (!paths.localeFile.isEmpty() &&
+        !addComposeFile(paths.localeFile, paths, 0, files)) {
+        return std::nullopt;
+    }
+    return files;
+}
+
+// Key of the cache, changes when any of the files behind the table does.
+// Empty if they are not known.
+QByteArray composeKey(const QString &locale) {
+    const auto files = composeFiles(locale);
+    if (!files) {
+        return QByteArray();
+    }
+    QByteArray data = locale.toUtf8();
+    for (const auto &file : *files) {
+        const QFileInfo info(file);
+        data += '\n';
+        data += QFile::encodeName(file);
+        if (info.exists()) {
+            data += ':';
+            data += QByteArray::number(info.lastModified().toMSecsSinceEpoch());
+            data += ':';
+            data += QByteArray::number(info.size());
+        }
+    }
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+}
+
+QString cachePath(const QString &locale) {
+    const QString cacheDir =
+        QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+    if (cacheDir.isEmpty() || locale.isEmpty()) {
+        return QString();
+    }
+    QString name = locale;
+    name.replace(QLatin1Char('/'), QLatin1Char('_'));
+    return cacheDir + QStringLiteral("/fcitx5-qt/compose/") + name +
+           QStringLiteral(".cache");
+}
+
+} // namespace
+
+// All integers are in native byte order.
+struct ComposeCache::Header {
+    char magic[sizeof(cacheMagic)];
+    quint32 version;
+    quint32 nodeCount;
+    quint32 stringsSize;
+    quint32 reserved;
+    // SHA-1 of what the table is compiled from, see composeKey().
+    char key[20];
+};
+
+// Nodes follow the header, the first one is the root. Children of a node are
+// sorted by keysym. Leaves are the end of a sequence.
+struct ComposeCache::Node {
+    quint32 keysym;
+    quint32 firstChild;
+    quint32 childCount;
+    // Offset of the NUL terminated UTF-8 text of a leaf in the strings after
+    // the nodes, which start with an empty one.
+    quint32 text;
+};
+
+ComposeCache::~ComposeCache() {
+    if (data_) {
+        munmap(const_cast<uchar *>(data_), size_);
+    }
+}
+
+std::unique_ptr<ComposeCache> ComposeCache::open(const QString &locale) {
+    const QString path = cachePath(locale);
+    if (path.isEmpty()) {
+        return nullptr;
+    }
+    const QByteArray key = composeKey(locale);
+    if (key.isEmpty()) {
+        return nullptr;
+    }
+    return map(path, key);
+}
+
+bool ComposeCache::build(const QString &locale,
+                         struct xkb_compose_table *table) {
+    const QString path = cachePath(locale);
+    if (path.isEmpty()) {
+        return false;
+    }
+    const QByteArray key = composeKey(locale);
+    if (key.isEmpty()) {
+        return false;
+    }
+    return write(path, key, table);
+}
+
+std::unique_ptr<ComposeCache> ComposeCache::map(const QString &path,
+                                                const QByteArray &key) {
+    const int fd =
+        ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 &&
+        st.st_size >= static_cast<off_t>(sizeof(Header))) {
+        // The file is only ever replaced as a whole, never modified in place,
+        // so the mapping stays valid.
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+
+    std::unique_ptr<ComposeCache> cache(new ComposeCache);
+    cache->data_ = static_cast<const uchar *>(data);
+    cache->size_ = st.st_size;
+    if (!cache->validate(key)) {
+        return nullptr;
+    }
+    return cache;
+}
+
+bool ComposeCache::validate(const QByteArray &key) {
+    static_assert(sizeof(Header) % alignof(Node) == 0,
+                  "Nodes must be aligned.");
+    const auto *header = reinterpret_cast<const Header *>(data_);
+    if (memcmp(header->magic, cacheMagic, sizeof(cacheMagic)) != 0 ||
+        header->version != cacheVersion ||
+        key.size() != static_cast<int>(sizeof(header->key)) ||
+        memcmp(header->key, key.constData(), sizeof(header->key)) != 0) {
+        return false;
+    }
+    const quint64 nodesSize = quint64(header->nodeCount) * sizeof(Node);
+    if (!header->nodeCount || !header->stringsSize ||
+        sizeof(Header) + nodesSize + header->stringsSize != size_) {
+        return false;
+    }
+    nodes_ = reinterpret_cast<const Node *>(data_ + sizeof(Header));
+    nodeCount_ = header->nodeCount;
+    strings_ = reinterpret_cast<const char *>(data_ + sizeof(Header) +
+                                              nodesSize);
+    stringsSize_ = header->stringsSize;
+    // So that every offset within the strings is NUL terminated.
+    return strings_[stringsSize_ - 1] == '\0';
+}
+
+bool ComposeCache::write(const QString &path, const QByteArray &key,
+                         struct xkb_compose_table *table) {
+#ifdef FCITX_QT_HAS_COMPOSE_ITERATOR
+    if (!table || key.size() != static_cast<int>(sizeof(Header::key))) {
+        return false;
+    }
+    struct TrieNode {
+        std::map<quint32, std::unique_ptr<TrieNode>> children;
+        quint32 text = 0;
+    };
+    TrieNode root;
+    std::string strings(1, '\0');
+    std::unordered_map<std::string, quint32> stringOffsets{{"", 0}};
+
+    struct xkb_compose_table_iterator *iter =
+        xkb_compose_table_iterator_new(table);
+    if (!iter) {
+        return false;
+    }
+    while (struct xkb_compose_table_entry *entry =
+               xkb_compose_table_iterator_next(iter)) {
+        size_t length = 0;
+        const xkb_keysym_t *sequence =
+            xkb_compose_table_entry_sequence(entry, &length);
+        TrieNode *node = &root;
+        for (size_t i = 0; i < length; i++) {
+            auto &child = node->children[sequence[i]];
+            if (!child) {
+                child = std::make_unique<TrieNode>();
+            }
+            node = child.get();
+        }
+
+        std::string text = xkb_compose_table_entry_utf8(entry);
+        if (text.empty()) {
+            std::array<char, 64> buffer;
+            if (xkb_keysym_to_utf8(xkb_compose_table_entry_keysym(entry),
+                                   buffer.data(), buffer.size()) > 0) {
+                text = buffer.data();
+            }
+        }
+        auto [offset, inserted] =
+            stringOffsets.emplace(text, static_cast<quint32>(strings.size()));
+        if (inserted) {
+            strings.append(text);
+            strings.push_back('\0');
+        }
+        node->text = offset->second;
+    }
+    xkb_compose_table_iterator_free(iter);
+
+    // Breadth first, so that the children of a node are next to each other.
+    std::vector<Node> nodes(1, Node{0, 0, 0, 0});
+    std::deque<std::pair<const TrieNode *, size_t>> queue{{&root, 0}};
+    while (!queue.empty()) {
+        auto [trie, index] = queue.front();
+        queue.pop_front();
+        nodes[index].firstChild = nodes.size();
+        nodes[index].childCount = trie->children.size();
+        for (const auto &[keysym, child] : trie->children) {
+            queue.emplace_back(child.get(), nodes.size());
+            nodes.push_back(Node{keysym, 0, 0,
+                                 child->children.empty() ? child->text : 0});
+        }
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = cacheVersion;
+    header.nodeCount = nodes.size();
+    header.stringsSize = strings.size();
+    memcpy(header.key, key.constData(), sizeof(header.key));
+
+    if (!QDir().mkpath(QFileInfo(path).path())) {
+        return false;
+    }
+    // Replaced atomically, so that no process maps a partial file.
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(nodes.data()),
+               nodes.size() * sizeof(Node));
+    file.write(strings.data(), strings.size());
+    return file.commit();
+#else
+    Q_UNUSED(path);
+    Q_UNUSED(key);
+    Q_UNUSED(table);
+    return false;
+#endif
+}
+
+quint32 ComposeCache::findChild(quint32 node, quint32 keysym) const {
+    const Node &parent = nodes_[node];
+    if (!parent.childCount || !parent.firstChild ||
+        quint64(parent.firstChild) + parent.childCount > nodeCount_) {
+        return 0;
+    }
+    const Node *begin = nodes_ + parent.firstChild;
+    const Node *end = begin + parent.childCount;
+    const Node *child = std::lower_bound(
+        begin, end, keysym,
+        [](const Node &node, quint32 value) { return node.keysym < value; });
+    if (child == end || child->keysym != keysym) {
+        return 0;
+    }
+    return child - nodes_;
+}
+
+ComposeCache::Status ComposeCache::feed(quint32 keysym) {
+    if (isModifier(keysym)) {
+        return Status::Ignored;
+    }
+    const quint32 child = findChild(node_, keysym);
+    if (!child) {
+        if (!node_) {
+            return Status::Nothing;
+        }
+        node_ = 0;
+        return Status::Cancelled;
+    }
+    const Node &node = nodes_[child];
+    if (node.childCount) {
+        node_ = child;
+        return Status::Composing;
+    }
+    node_ = 0;
+    text_ = node.text < stringsSize_ ? QString::fromUtf8(strings_ + node.text)
+                                     : QString();
+    return Status::Composed;
+}
+
+} // namespace fcitx
@@ -0,0 +1,88 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+#ifndef _PLATFORMINPUTCONTEXT_COMPOSECACHE_H_
+#define _PLATFORMINPUTCONTEXT_COMPOSECACHE_H_
+
+#include <QByteArray>
+#include <QString>
+#include <cstddef>
+#include <memory>
+#include <xkbcommon/xkbcommon-compose.h>
+
+namespace fcitx {
+
+// Compose sequences compiled into a file that is mapped read-only, so all
+// processes using the same file share one copy of it. The file is a trie of
+// keysyms with the children of every node stored next to each other, and
+// only refers to its own content by offset.
+//
+// It also runs the compose state machine of one input context, which is the
+// same as the one of xkb_compose_state.
+class ComposeCache {
+public:
+    enum class Status {
+        // The key is not part of compose, e.g. a modifier.
+        Ignored,
+        // The key does not start a sequence.
+        Nothing,
+        Composing,
+        // A sequence is done, see text().
+        Composed,
+        // The key does not continue the sequence, which is dropped.
+        Cancelled,
+    };
+
+    ~ComposeCache();
+
+    // Map the cache of the locale from the user cache directory. Returns
+    // null if it does not exist, or the Compose files changed since it was
+    // written. Those are found like xkbcommon does, following aliases of
+    // the locale and includes. If that fails, e.g. for an include with a
+    // substitution it does not know, nothing is ever cached.
+    static std::unique_ptr<ComposeCache> open(const QString &locale);
+    // Write the cache of the locale from table, which must be compiled for
+    // the same locale. Fails if xkbcommon is too old to enumerate table.
+    static bool build(const QString &locale, struct xkb_compose_table *table);
+
+    // Same as above, with an explicit path of the cache. key identifies what
+    // the table is compiled from, a cache with another key is not mapped.
+    static std::unique_ptr<ComposeCache> map(const QString &path,
+                                             const QByteArray &key);
+    static bool write(const QString &path, const QByteArray &key,
+                      struct xkb_compose_table *table);
+
+    Status feed(quint32 keysym);
+    void reset() { node_ = 0; }
+    // Text of the last composed sequence.
+    const QString &text() const { return text_; }
+
+private:
+    ComposeCache() = default;
+    ComposeCache(const ComposeCache &) = delete;
+
+    struct Header;
+    struct Node;
+
+    // Returns the index of the child of node with keysym, or 0 if there is
+    // none, since the root is never a child.
+    quint32 findChild(quint32 node, quint32 keysym) const;
+    bool validate(const QByteArray &key);
+
+    const uchar *data_ = nullptr;
+    size_t size_ = 0;
+    const Node *nodes_ = nullptr;
+    quint32 nodeCount_ = 0;
+    const char *strings_ = nullptr;
+    quint32 stringsSize_ = 0;
+    // Current node of the state machine, 0 is the root.
+    quint32 node_ = 0;
+    QString text_;
+};
+
+} // namespace fcitx
+
+#endif // _PLATFORMINPUTCONTEXT_COMPOSECACHE_H_
@@ -389,12 +389,12 @@ void UpdateLayout(QTextLayout &layout, const FcitxTheme &theme,
     layout.setFormats(formats);
 }
 
-void FcitxCandidateWindow::updateClientSideUI(
-    const FcitxQtFormattedPreeditList &preedit, int cursorpos,
-    const FcitxQtFormattedPreeditList &auxUp,
-    const FcitxQtFormattedPreeditList &auxDown,
-    const FcitxQtStringKeyValueList &candidates, int candidateIndex,
-    int layoutHint, bool hasPrev, bool hasNext) {
+void FcitxCandidateWindow::updateClientSideUI(ClientSideUIView &view) {
+    const auto &preedit = view.preedit();
+    const auto &auxUp = view.auxUp();
+    const auto &auxDown = view.auxDown();
+    const auto &candidates = view.candidates();
+    const int cursorpos = view.cursor();
     bool preeditVisible = !preedit.isEmpty();
     bool auxUpVisbile = !auxUp.isEmpty();
     bool auxDownVisible = !auxDown.isEmpty();
@@ -403,38 +403,60 @@ void FcitxCandidateWindow::updateClientSideUI(
         preeditVisible || auxUpVisbile || auxDownVisible || candidatesVisible;
     auto window = context_->focusWindowWrapper();
     if (!theme_ || !visible || !window || window != parent_) {
+        hasContent_ = false;
         hide();
         return;
     }
 
-    UpdateLayout(upperLayout_, *theme_, {auxUp, preedit});
-    if (cursorpos >= 0) {
-        int auxUpLength = 0;
-        for (const auto &auxUpText : auxUp) {
-            auxUpLength += auxUpText.string().length();
+    // Layouts are rebuilt only if their text or the theme changed, e.g. not
+    // when only the highlighted candidate moves.
+    const bool themeChanged =
+        layoutFont_ != theme_->font() ||
+        layoutHighlightColor_ != theme_->highlightColor() ||
+        layoutHighlightBackgroundColor_ != theme_->highlightBackgroundColor();
+    if (themeChanged) {
+        layoutFont_ = theme_->font();
+        layoutHighlightColor_ = theme_->highlightColor();
+        layoutHighlightBackgroundColor_ = theme_->highlightBackgroundColor();
+    }
+    using Section = ClientSideUIView::Section;
+    const quint64 upperFingerprint =
+        (view.fingerprint(Section::AuxUp) * 0x100000001b3ull) ^
+        view.fingerprint(Section::Preedit);
+    if (themeChanged || upperFingerprint != upperFingerprint_) {
+        UpdateLayout(upperLayout_, *theme_, {auxUp, preedit});
+        doLayout(upperLayout_);
+        upperFingerprint_ = upperFingerprint;
+    }
+    auxUpLength_ = 0;
+    for (const auto &auxUpText : auxUp) {
+        auxUpLength_ += auxUpText.string().length();
+    }
+    updateCursor(cursorpos);
+    const quint64 lowerFingerprint = view.fingerprint(Section::AuxDown);
+    if (themeChanged || lowerFingerprint != lowerFingerprint_) {
+        UpdateLayout(lowerLayout_, *theme_, {auxDown});
+        doLayout(lowerLayout_);
+        lowerFingerprint_ = lowerFingerprint;
+    }
+    const quint64 candidatesFingerprint =
+        view.fingerprint(Section::Candidates);
+    if (themeChanged || candidatesFingerprint != candidatesFingerprint_) {
+        labelLayouts_.clear();
+        candidateLayouts_.clear();
+        for (int i = 0; i < candidates.size(); i++) {
+            labelLayouts_.emplace_back(std::make_unique<MultilineText>(
+                theme_->font(), candidates[i].key()));
+            candidateLayouts_.emplace_back(std::make_unique<MultilineText>(
+                theme_->font(), candidates[i].value()));
         }
-        // Get the preedit part
-        auto preeditString = upperLayout_.text().mid(auxUpLength).toUtf8();
-        preeditString = preeditString.mid(0, cursorpos);
-        cursor_ = auxUpLength + QString::fromUtf8(preeditString).length();
-    } else {
-        cursor_ = -1;
+        candidatesFingerprint_ = candidatesFingerprint;
     }
-    doLayout(upperLayout_);
-    UpdateLayout(lowerLayout_, *theme_, {auxDown});
-    doLayout(lowerLayout_);
-    labelLayouts_.clear();
-    candidateLayouts_.clear();
-    for (int i = 0; i < candidates.size(); i++) {
-        labelLayouts_.emplace_back(std::make_unique<MultilineText>(
-            theme_->font(), candidates[i].key()));
-        candidateLayouts_.emplace_back(std::make_unique<MultilineText>(
-            theme_->font(), candidates[i].value()));
-    }
-    highlight_ = candidateIndex;
-    hasPrev_ = hasPrev;
-    hasNext_ = hasNext;
-    layoutHint_ = static_cast<FcitxCandidateLayoutHint>(layoutHint);
+    hasContent_ = true;
+    highlight_ = view.candidateIndex();
+    hasPrev_ = view.hasPrev();
+    hasNext_ = view.hasNext();
+    layoutHint_ = static_cast<FcitxCandidateLayoutHint>(view.layoutHint());
 
     actualSize_ = sizeHint();
 
@@ -513,6 +535,30 @@ void FcitxCandidateWindow::updateClientSideUI(
     show();
 }
 
+bool FcitxCandidateWindow::updateClientSideUIHighlight(int candidateIndex,
+                                                       int cursorpos) {
+    if (!hasContent_) {
+        return false;
+    }
+    // Kept for when the window is shown again, renderNow() only paints an
+    // exposed window.
+    highlight_ = candidateIndex;
+    updateCursor(cursorpos);
+    renderNow();
+    return true;
+}
+
+void FcitxCandidateWindow::updateCursor(int cursorpos) {
+    if (cursorpos < 0) {
+        cursor_ = -1;
+        return;
+    }
+    // Get the preedit part
+    auto preeditString = upperLayout_.text().mid(auxUpLength_).toUtf8();
+    preeditString = preeditString.mid(0, cursorpos);
+    cursor_ = auxUpLength_ + QString::fromUtf8(preeditString).length();
+}
+
 void FcitxCandidateWindow::mouseMoveEvent(QMouseEvent *event) {
     bool needRepaint = false;
 
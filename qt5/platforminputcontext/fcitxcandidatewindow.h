@@ -8,6 +8,7 @@
 #ifndef _PLATFORMINPUTCONTEXT_FCITXCANDIDATEWINDOW_H_
 #define _PLATFORMINPUTCONTEXT_FCITXCANDIDATEWINDOW_H_
 
+#include "clientsideuiview.h"
 #include "fcitxflags.h"
 #include "fcitxqtdbustypes.h"
 #include <QBackingStore>
@@ -37,13 +38,10 @@ public:
 public Q_SLOTS:
     void renderLater();
     void renderNow();
-    void updateClientSideUI(const FcitxQtFormattedPreeditList &preedit,
-                            int cursorpos,
-                            const FcitxQtFormattedPreeditList &auxUp,
-                            const FcitxQtFormattedPreeditList &auxDown,
-                            const FcitxQtStringKeyValueList &candidates,
-                            int candidateIndex, int layoutHint, bool hasPrev,
-                            bool hasNext);
+    void updateClientSideUI(ClientSideUIView &view);
+    // Moves the highlight and the cursor without a new layout, also while
+    // hidden. Returns false if there is no content to apply it to.
+    bool updateClientSideUIHighlight(int candidateIndex, int cursorpos);
 
     QSize sizeHint();
 
@@ -67,6 +65,8 @@ protected:
     }
 
 private:
+    void updateCursor(int cursorpos);
+
     const bool isWayland_ =
         QGuiApplication::platformName().startsWith("wayland");
     QSize actualSize_;
@@ -77,7 +77,18 @@ private:
     QTextLayout lowerLayout_;
     std::vector<std::unique_ptr<MultilineText>> candidateLayouts_;
     std::vector<std::unique_ptr<MultilineText>> labelLayouts_;
+    // What the layouts above are built from.
+    quint64 upperFingerprint_ = 0;
+    quint64 lowerFingerprint_ = 0;
+    quint64 candidatesFingerprint_ = 0;
+    QFont layoutFont_;
+    QColor layoutHighlightColor_;
+    QColor layoutHighlightBackgroundColor_;
+    // Whether the layouts hold the content of the last full update.
+    bool hasContent_ = false;
     int cursor_ = -1;
+    // Length of aux up in upperLayout_, the preedit follows it.
+    int auxUpLength_ = 0;
     int highlight_ = -1;
     int hoverIndex_ = -1;
     int accAngle_ = 0;
@@ -0,0 +1,117 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+#ifndef _PLATFORMINPUTCONTEXT_KEYEVENTQUEUE_H_
+#define _PLATFORMINPUTCONTEXT_KEYEVENTQUEUE_H_
+
+#include <QKeyEvent>
+#include <QPointer>
+#include <QString>
+#include <QWindow>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace fcitx {
+
+// The part of QKeyEvent that we need to remember for a key, QKeyEvent itself
+// can't be reused and would need a heap allocation for every key.
+struct KeyEventRecord {
+    void set(const QKeyEvent &event) {
+        type = event.type();
+        key = event.key();
+        modifiers = event.modifiers();
+        nativeScanCode = event.nativeScanCode();
+        nativeVirtualKey = event.nativeVirtualKey();
+        nativeModifiers = event.nativeModifiers();
+        // QString is implicitly shared, so this only adds a reference.
+        text = event.text();
+        isAutoRepeat = event.isAutoRepeat();
+        count = event.count();
+        timestamp = event.timestamp();
+    }
+
+    bool isValid() const { return type != QEvent::None; }
+
+    QEvent::Type type = QEvent::None;
+    int key = 0;
+    Qt::KeyboardModifiers modifiers = Qt::NoModifier;
+    quint32 nativeScanCode = 0;
+    quint32 nativeVirtualKey = 0;
+    quint32 nativeModifiers = 0;
+    QString text;
+    bool isAutoRepeat = false;
+    int count = 1;
+    ulong timestamp = 0;
+};
+
+// Fixed size ring buffer of keys that are sent to fcitx but not handled yet.
+// All slots are allocated up front, so queuing a key never allocates.
+class KeyEventQueue {
+public:
+    struct Entry {
+        KeyEventRecord event;
+        QPointer<QWindow> window;
+        // When the key is sent to fcitx, only set if latency is tracked.
+        std::chrono::steady_clock::time_point sentTime;
+        bool finished = false;
+        bool error = false;
+        bool filtered = false;
+        // Not sent to fcitx since it does not want the key, only queued to
+        // keep the order with the keys before it.
+        bool passthrough = false;
+        // Auto repeats of the same key merged into this one.
+        int mergedRepeats = 0;
+    };
+
+    explicit KeyEventQueue(size_t capacity)
+        : entries_(capacity > 0 ? capacity : 1) {}
+
+    size_t capacity() const { return entries_.size(); }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    bool full() const { return size_ == entries_.size(); }
+
+    // Index of the slot of the oldest key, only valid if not empty.
+    size_t frontIndex() const { return head_; }
+    Entry &front() { return entries_[head_]; }
+    // The newest key, only valid if not empty.
+    Entry &back() { return entries_[indexAt(size_ - 1)]; }
+    Entry &slot(size_t index) { return entries_[index]; }
+
+    // Index of i-th oldest key.
+    size_t indexAt(size_t i) const { return (head_ + i) % entries_.size(); }
+
+    // Returns the index of the slot for the new key, the queue must not be
+    // full.
+    size_t push() {
+        const size_t index = indexAt(size_);
+        auto &entry = entries_[index];
+        entry.finished = false;
+        entry.error = false;
+        entry.filtered = false;
+        entry.passthrough = false;
+        entry.mergedRepeats = 0;
+        ++size_;
+        return index;
+    }
+
+    void pop() {
+        auto &entry = entries_[head_];
+        entry.window = nullptr;
+        head_ = indexAt(1);
+        --size_;
+    }
+
+private:
+    std::vector<Entry> entries_;
+    size_t head_ = 0;
+    size_t size_ = 0;
+};
+
+} // namespace fcitx
+
+#endif // _PLATFORMINPUTCONTEXT_KEYEVENTQUEUE_H_
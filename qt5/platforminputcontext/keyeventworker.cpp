@@ -0,0 +1,41 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+#include "keyeventworker.h"
+#include <QCoreApplication>
+#include <QMutexLocker>
+
+namespace fcitx {
+
+QEvent::Type KeyReplyEvent::eventType() {
+    static const auto type =
+        static_cast<QEvent::Type>(QEvent::registerEventType());
+    return type;
+}
+
+void KeyReplyForwarder::send(const QDBusConnection &connection,
+                             const QDBusMessage &message) {
+    const bool sent = connection.callWithCallback(
+        message, this, SLOT(finished(bool)), SLOT(error(QDBusError)));
+    target_->unsent--;
+    if (!sent) {
+        post(true, false);
+    }
+}
+
+void KeyReplyForwarder::finished(bool filtered) { post(false, filtered); }
+
+void KeyReplyForwarder::error(const QDBusError &) { post(true, false); }
+
+void KeyReplyForwarder::post(bool error, bool filtered) {
+    QMutexLocker locker(&target_->mutex);
+    if (index_ < target_->receivers.size()) {
+        QCoreApplication::postEvent(target_->receivers[index_],
+                                    new KeyReplyEvent(error, filtered));
+    }
+}
+
+} // namespace fcitx
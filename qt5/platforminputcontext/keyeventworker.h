@@ -0,0 +1,72 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+#ifndef _PLATFORMINPUTCONTEXT_KEYEVENTWORKER_H_
+#define _PLATFORMINPUTCONTEXT_KEYEVENTWORKER_H_
+
+#include <QDBusConnection>
+#include <QDBusError>
+#include <QDBusMessage>
+#include <QEvent>
+#include <QMutex>
+#include <QObject>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace fcitx {
+
+// Posted to the receiver of a key in the GUI thread once the reply of the
+// key is received by the key event thread.
+class KeyReplyEvent : public QEvent {
+public:
+    KeyReplyEvent(bool error, bool filtered)
+        : QEvent(eventType()), error_(error), filtered_(filtered) {}
+
+    static QEvent::Type eventType();
+
+    bool error() const { return error_; }
+    bool filtered() const { return filtered_; }
+
+private:
+    bool error_;
+    bool filtered_;
+};
+
+// Receivers of one input context, shared with its forwarders so they never
+// post to a receiver that is already destroyed.
+struct KeyReplyTarget {
+    QMutex mutex;
+    std::vector<QObject *> receivers;
+    // Keys handed to the key event thread that it did not send yet.
+    std::atomic<int> unsent{0};
+};
+
+// Lives in the key event thread, sends the key for one slot of the key queue
+// and posts the reply back to the receiver of the same slot.
+class KeyReplyForwarder : public QObject {
+    Q_OBJECT
+public:
+    KeyReplyForwarder(std::shared_ptr<KeyReplyTarget> target, size_t index)
+        : target_(std::move(target)), index_(index) {}
+
+    // Must be called in the key event thread.
+    void send(const QDBusConnection &connection, const QDBusMessage &message);
+
+public Q_SLOTS:
+    void finished(bool filtered);
+    void error(const QDBusError &error);
+
+private:
+    void post(bool error, bool filtered);
+
+    std::shared_ptr<KeyReplyTarget> target_;
+    size_t index_;
+};
+
+} // namespace fcitx
+
+#endif // _PLATFORMINPUTCONTEXT_KEYEVENTWORKER_H_
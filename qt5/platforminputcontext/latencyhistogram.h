@@ -0,0 +1,103 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+#ifndef _PLATFORMINPUTCONTEXT_LATENCYHISTOGRAM_H_
+#define _PLATFORMINPUTCONTEXT_LATENCYHISTOGRAM_H_
+
+#include <QString>
+#include <QtGlobal>
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace fcitx {
+
+// Histogram of latency in microseconds, in the same log-linear layout as
+// HdrHistogram. Values below 2^SubBucketBits are recorded exactly, every
+// power of two range above that is split into 2^(SubBucketBits - 1) linear
+// buckets, so the relative error of a percentile is below 1/16.
+class LatencyHistogram {
+public:
+    void record(quint64 usec) {
+        usec = std::min(usec, MaxValue);
+        counts_[indexOf(usec)]++;
+        count_++;
+        max_ = std::max(max_, usec);
+    }
+
+    void reset() {
+        counts_.fill(0);
+        count_ = 0;
+        max_ = 0;
+    }
+
+    quint64 count() const { return count_; }
+    quint64 max() const { return max_; }
+
+    // p is within [0, 100].
+    quint64 percentile(double p) const {
+        if (!count_) {
+            return 0;
+        }
+        auto target = static_cast<quint64>(std::ceil(p / 100.0 * count_));
+        target = std::max<quint64>(target, 1);
+        quint64 seen = 0;
+        for (size_t i = 0; i < counts_.size(); i++) {
+            seen += counts_[i];
+            if (seen >= target) {
+                return std::min(highestValueOf(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    QString summary() const {
+        return QStringLiteral("n=%1 p50=%2us p95=%3us p99=%4us max=%5us")
+            .arg(count_)
+            .arg(percentile(50))
+            .arg(percentile(95))
+            .arg(percentile(99))
+            .arg(max_);
+    }
+
+private:
+    static constexpr int SubBucketBits = 5;
+    static constexpr quint64 SubBuckets = 1ull << SubBucketBits;
+    static constexpr quint64 HalfSubBuckets = SubBuckets / 2;
+    // Around 19 hours, anything beyond that is not a latency anymore.
+    static constexpr int MaxBits = 36;
+    static constexpr quint64 MaxValue = (1ull << MaxBits) - 1;
+    static constexpr size_t BucketCount =
+        SubBuckets + (MaxBits - SubBucketBits) * HalfSubBuckets;
+
+    static size_t indexOf(quint64 value) {
+        if (value < SubBuckets) {
+            return value;
+        }
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - SubBucketBits + 1;
+        return SubBuckets + (shift - 1) * HalfSubBuckets +
+               ((value >> shift) - HalfSubBuckets);
+    }
+
+    static quint64 highestValueOf(size_t index) {
+        if (index < SubBuckets) {
+            return index;
+        }
+        const size_t shift = (index - SubBuckets) / HalfSubBuckets + 1;
+        const quint64 sub =
+            (index - SubBuckets) % HalfSubBuckets + HalfSubBuckets;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    std::array<quint64, BucketCount> counts_{};
+    quint64 count_ = 0;
+    quint64 max_ = 0;
+};
+
+} // namespace fcitx
+
+#endif // _PLATFORMINPUTCONTEXT_LATENCYHISTOGRAM_H_
@@ -7,11 +7,14 @@
 
 #include <QDBusConnection>
 #include <QDebug>
+#include <QEventLoop>
 #include <QInputMethod>
 #include <QKeyEvent>
 #include <QMetaMethod>
 #include <QPalette>
 #include <QTextCharFormat>
+#include <QThread>
+#include <QTimer>
 #include <QWidget>
 #include <QWindow>
 #include <qpa/qplatformcursor.h>
@@ -29,12 +32,16 @@
 #include "qfcitxplatforminputcontext.h"
 #include "qtkey.h"
 
+#include <algorithm>
 #include <array>
 #include <memory>
+#include <string>
 #include <xcb/xcb.h>
 
 namespace fcitx {
 
+Q_LOGGING_CATEGORY(fcitx5qtKeyLatency, "fcitx5.qt.keylatency", QtInfoMsg)
+
 template <typename T>
 using XCBReply = std::unique_ptr<T, decltype(&std::free)>;
 
@@ -121,6 +128,34 @@ static bool get_boolean_env(const char *name, bool defval) {
     return true;
 }
 
+static int get_int_env(const char *name, int defval) {
+    const char *value = getenv(name);
+
+    if (value == nullptr)
+        return defval;
+
+    char *end = nullptr;
+    long result = strtol(value, &end, 10);
+    if (end == value || *end != '\0')
+        return defval;
+
+    return result;
+}
+
+static KeyRepeatCoalesce get_repeat_coalesce_env() {
+    const char *value = getenv("FCITX_QT_KEY_REPEAT_COALESCE");
+
+    if (value == nullptr)
+        return KeyRepeatCoalesce::Merge;
+
+    if (strcmp(value, "none") == 0)
+        return KeyRepeatCoalesce::None;
+    if (strcmp(value, "drop") == 0)
+        return KeyRepeatCoalesce::Drop;
+
+    return KeyRepeatCoalesce::Merge;
+}
+
 static inline const char *get_locale() {
     const char *locale = getenv("LC_ALL");
     if (!locale)
@@ -157,24 +192,46 @@ QObject *deepestFocusProxy(QObject *object) {
 FcitxQtICData::FcitxQtICData(QFcitxPlatformInputContext *context,
                              QWindow *window)
     : proxy(new FcitxQtInputContextProxy(context->watcher(), context)),
-      context_(context), window_(window) {
+      pendingKeys(context->maxPendingKeys()), context_(context),
+      window_(window) {
     proxy->setProperty("icData",
                        QVariant::fromValue(static_cast<void *>(this)));
-    QObject::connect(window, &QWindow::visibilityChanged, proxy,
-                     [this](bool visible) {
-                         if (!visible) {
-                             resetCandidateWindow();
-                         }
-                     });
+    keyReceivers.reserve(pendingKeys.capacity());
+    for (size_t i = 0; i < pendingKeys.capacity(); i++) {
+        keyReceivers.push_back(
+            std::make_unique<ProcessKeyReceiver>(context, this, i));
+    }
+    if (auto *thread = context->keyThread()) {
+        keyReplyTarget = std::make_shared<KeyReplyTarget>();
+        for (const auto &receiver : keyReceivers) {
+            keyReplyTarget->receivers.push_back(receiver.get());
+        }
+        keyForwarders.reserve(pendingKeys.capacity());
+        for (size_t i = 0; i < pendingKeys.capacity(); i++) {
+            auto *forwarder = new KeyReplyForwarder(keyReplyTarget, i);
+            forwarder->moveToThread(thread);
+            keyForwarders.push_back(forwarder);
+        }
+    }
     QObject::connect(context_->watcher(), &FcitxQtWatcher::availabilityChanged,
                      proxy, [this](bool avail) {
                          if (!avail) {
                              resetCandidateWindow();
                          }
                      });
-    window->installEventFilter(this);
+    if (window) {
+        attachWindow(window);
+    }
 }
 FcitxQtICData::~FcitxQtICData() {
+    waitForKeysSent();
+    if (keyReplyTarget) {
+        QMutexLocker locker(&keyReplyTarget->mutex);
+        keyReplyTarget->receivers.clear();
+    }
+    for (auto *forwarder : keyForwarders) {
+        forwarder->deleteLater();
+    }
     if (window_) {
         window_->removeEventFilter(this);
     }
@@ -182,6 +239,32 @@ FcitxQtICData::~FcitxQtICData() {
     resetCandidateWindow();
 }
 
+void FcitxQtICData::attachWindow(QWindow *window) {
+    visibilityConnection_ = QObject::connect(
+        window, &QWindow::visibilityChanged, proxy, [this](bool visible) {
+            if (!visible) {
+                resetCandidateWindow();
+            }
+        });
+    window->installEventFilter(this);
+}
+
+void FcitxQtICData::setWindow(QWindow *window) {
+    if (window_ && window_ == window) {
+        return;
+    }
+    if (window_) {
+        window_->removeEventFilter(this);
+    }
+    QObject::disconnect(visibilityConnection_);
+    // Candidate window is a child of the old window.
+    resetCandidateWindow();
+    window_ = window;
+    if (window) {
+        attachWindow(window);
+    }
+}
+
 bool FcitxQtICData::eventFilter(QObject *, QEvent *event) {
     if (event->type() != QMouseEvent::MouseButtonPress) {
         return false;
@@ -202,6 +285,7 @@ bool FcitxQtICData::eventFilter(QObject *, QEvent *event) {
             QLatin1String("Konsole::TerminalDisplay")) {
         if (context_->commitPreedit()) {
             if (proxy->isValid()) {
+                waitForKeysSent();
                 proxy->reset();
             }
         }
@@ -214,15 +298,84 @@ FcitxCandidateWindow *FcitxQtICData::candidateWindow() {
         candidateWindow_ = new FcitxCandidateWindow(window(), context_);
         QObject::connect(
             candidateWindow_, &FcitxCandidateWindow::candidateSelected, proxy,
-            [proxy = proxy](int index) { proxy->selectCandidate(index); });
+            [this](int index) {
+                waitForKeysSent();
+                proxy->selectCandidate(index);
+            });
         QObject::connect(candidateWindow_, &FcitxCandidateWindow::prevClicked,
-                         proxy, [proxy = proxy]() { proxy->prevPage(); });
+                         proxy, [this]() {
+                             waitForKeysSent();
+                             proxy->prevPage();
+                         });
         QObject::connect(candidateWindow_, &FcitxCandidateWindow::nextClicked,
-                         proxy, [proxy = proxy]() { proxy->nextPage(); });
+                         proxy, [this]() {
+                             waitForKeysSent();
+                             proxy->nextPage();
+                         });
     }
     return candidateWindow_;
 }
 
+bool ProcessKeyReceiver::event(QEvent *event) {
+    if (event->type() == KeyReplyEvent::eventType()) {
+        auto *reply = static_cast<KeyReplyEvent *>(event);
+        if (reply->error()) {
+            error(QDBusError());
+        } else {
+            finished(reply->filtered());
+        }
+        return true;
+    }
+    return QObject::event(event);
+}
+
+bool ProcessKeyReceiver::takeStaleReply() {
+    // Replies of one slot come in the order the keys are sent.
+    if (staleReplies_) {
+        staleReplies_--;
+        return true;
+    }
+    return false;
+}
+
+void ProcessKeyReceiver::finished(bool filtered) {
+    if (takeStaleReply()) {
+        return;
+    }
+    auto &entry = data_->pendingKeys.slot(index_);
+    context_->recordKeyLatency(*data_, entry.sentTime);
+    entry.finished = true;
+    entry.filtered = filtered;
+    Q_EMIT replied();
+    if (!data_->waitingKeyReply) {
+        context_->processPendingKeys(*data_);
+    }
+}
+
+void ProcessKeyReceiver::error(const QDBusError &) {
+    if (takeStaleReply()) {
+        return;
+    }
+    auto &entry = data_->pendingKeys.slot(index_);
+    context_->recordKeyLatency(*data_, entry.sentTime);
+    entry.finished = true;
+    entry.error = true;
+    Q_EMIT replied();
+    if (!data_->waitingKeyReply) {
+        context_->processPendingKeys(*data_);
+    }
+}
+
+void FcitxQtICData::waitForKeysSent() {
+    if (!keyReplyTarget || !keyReplyTarget->unsent) {
+        return;
+    }
+    // The key event thread handles what is queued to it in order, so the
+    // keys queued before are sent once this returns.
+    QMetaObject::invokeMethod(
+        keyForwarders.front(), []() {}, Qt::BlockingQueuedConnection);
+}
+
 void FcitxQtICData::resetCandidateWindow() {
     if (auto *w = candidateWindow_.data()) {
         candidateWindow_ = nullptr;
@@ -232,29 +385,65 @@ void FcitxQtICData::resetCandidateWindow() {
 }
 
 QFcitxPlatformInputContext::QFcitxPlatformInputContext()
-    : watcher_(new FcitxQtWatcher(
-          QDBusConnection::connectToBus(QDBusConnection::SessionBus, "fcitx"),
-          this)),
+    : watcher_(new FcitxQtWatcher(this)),
       cursorPos_(0), useSurroundingText_(false),
-      syncMode_(get_boolean_env("FCITX_QT_USE_SYNC", false)), destroy_(false),
-      xkbContext_(_xkb_context_new_helper()),
-      xkbComposeTable_(xkbContext_ ? xkb_compose_table_new_from_locale(
-                                         xkbContext_.data(), get_locale(),
-                                         XKB_COMPOSE_COMPILE_NO_FLAGS)
-                                   : 0),
-      xkbComposeState_(xkbComposeTable_
-                           ? xkb_compose_state_new(xkbComposeTable_.data(),
-                                                   XKB_COMPOSE_STATE_NO_FLAGS)
-                           : 0) {
+      syncMode_(get_boolean_env("FCITX_QT_USE_SYNC", false)),
+      syncDeadline_(
+          std::max(get_int_env("FCITX_QT_SYNC_DEADLINE_MS", 0), 0)),
+      keyReplyTimeout_(
+          std::max(get_int_env("FCITX_QT_KEY_REPLY_TIMEOUT_MS", 500), 0)),
+      repeatCoalesce_(get_repeat_coalesce_env()),
+      maxPendingKeys_(
+          std::max(get_int_env("FCITX_QT_MAX_PENDING_KEYS", 16), 1)),
+      keyLatencyInterval_(
+          std::max(get_int_env("FCITX_QT_KEY_LATENCY_INTERVAL", 0), 0)),
+      keyLatencyReportOnExit_(
+          get_boolean_env("FCITX_QT_KEY_LATENCY_REPORT", false)),
+      deferInputContext_(
+          get_boolean_env("FCITX_QT_DEFER_INPUT_CONTEXT", false)),
+      sharedInputContext_(
+          get_boolean_env("FCITX_QT_SHARED_INPUT_CONTEXT", false)),
+      icPoolSize_(std::max(get_int_env("FCITX_QT_IC_POOL_SIZE", 0), 0)),
+      destroy_(false) {
     registerFcitxQtDBusTypes();
     watcher_->setWatchPortal(true);
-    watcher_->watch();
+    watcher_->setPeerToPeer(
+        get_boolean_env("FCITX_QT_USE_PEER_TO_PEER", false));
+
+    if (keyLatencyInterval_) {
+        auto *timer = new QTimer(this);
+        connect(timer, &QTimer::timeout, this,
+                &QFcitxPlatformInputContext::reportKeyLatency);
+        timer->start(keyLatencyInterval_ * 1000);
+    }
+
+    if (get_boolean_env("FCITX_QT_KEY_EVENT_THREAD", false)) {
+        keyThread_ = new QThread(this);
+        keyThread_->setObjectName(QStringLiteral("fcitx5-qt-key"));
+        keyThread_->start();
+    }
 }
 
 QFcitxPlatformInputContext::~QFcitxPlatformInputContext() {
+    if (keyLatencyReportOnExit_) {
+        reportKeyLatency();
+    }
     destroy_ = true;
     watcher_->unwatch();
     cleanUp();
+    if (composeFuture_.valid()) {
+        // Compiled but never used. The compilation stops at the next step, so
+        // this waits for one step at most.
+        composeCancelled_ = true;
+        if (auto *table = composeFuture_.get().table) {
+            xkb_compose_table_unref(table);
+        }
+    }
+    if (keyThread_) {
+        // Forwarders deleted by cleanUp are destroyed when the thread quits.
+        keyThread_->quit();
+        keyThread_->wait();
+    }
     delete watcher_;
 }
 
@@ -284,6 +473,7 @@ bool QFcitxPlatformInputContext::shouldDisableInputMethod() const {
 
 void QFcitxPlatformInputContext::cleanUp() {
     icMap_.clear();
+    icPool_.clear();
 
     if (!destroy_) {
         commitPreedit();
@@ -302,10 +492,14 @@ void QFcitxPlatformInputContext::invokeAction(QInputMethod::Action imAction,
     } else {
         return;
     }
+    // There may be no input context yet, see ensureICData.
     if (FcitxQtInputContextProxy *proxy = validIC();
-        proxy->supportInvokeAction()) {
+        proxy && proxy->supportInvokeAction()) {
         if (cursorPosition >= 0 && cursorPosition <= preedit_.length()) {
             auto ucs4Cursor = preedit_.left(cursorPosition).toUcs4().length();
+            static_cast<FcitxQtICData *>(
+                proxy->property("icData").value<void *>())
+                ->waitForKeysSent();
             proxy->invokeAction(action, ucs4Cursor);
         }
     } else {
@@ -341,8 +535,13 @@ bool checkUtf8(const QByteArray &byteArray) {
 void QFcitxPlatformInputContext::reset() {
     commitPreedit();
     if (FcitxQtInputContextProxy *proxy = validIC()) {
+        static_cast<FcitxQtICData *>(proxy->property("icData").value<void *>())
+            ->waitForKeysSent();
         proxy->reset();
     }
+    if (composeCache_) {
+        composeCache_->reset();
+    }
     if (xkbComposeState_) {
         xkb_compose_state_reset(xkbComposeState_.data());
     }
@@ -352,8 +551,13 @@ void QFcitxPlatformInputContext::reset() {
 void QFcitxPlatformInputContext::update(Qt::InputMethodQueries queries) {
     QWindow *window = focusWindowWrapper();
     FcitxQtInputContextProxy *proxy = validICByWindow(window);
-    if (!proxy)
+    if (!proxy) {
+        // Focus object may start to accept input method.
+        if (window && (queries & Qt::ImEnabled)) {
+            ensureICData(window);
+        }
         return;
+    }
 
     FcitxQtICData &data = *static_cast<FcitxQtICData *>(
         proxy->property("icData").value<void *>());
@@ -441,11 +645,13 @@ void QFcitxPlatformInputContext::update(Qt::InputMethodQueries queries) {
                 anchor = tempUCS4.size();
                 if (data.surroundingText != text) {
                     data.surroundingText = text;
-                    proxy->setSurroundingText(text, cursor, anchor);
+                    markDirty(data, FcitxQtICData::Dirty_SurroundingText);
                 } else {
                     if (data.surroundingAnchor != anchor ||
                         data.surroundingCursor != cursor)
-                        proxy->setSurroundingTextPosition(cursor, anchor);
+                        markDirty(
+                            data,
+                            FcitxQtICData::Dirty_SurroundingTextPosition);
                 }
                 data.surroundingCursor = cursor;
                 data.surroundingAnchor = anchor;
@@ -465,9 +671,10 @@ void QFcitxPlatformInputContext::commit() {
     FcitxQtInputContextProxy *proxy = validICByWindow(lastWindow_);
     commitPreedit(lastObject_);
     if (proxy) {
-        proxy->reset();
         FcitxQtICData &data = *static_cast<FcitxQtICData *>(
             proxy->property("icData").value<void *>());
+        data.waitForKeysSent();
+        proxy->reset();
         data.resetCandidateWindow();
     }
 }
@@ -486,20 +693,24 @@ void QFcitxPlatformInputContext::setFocusObject(QObject *object) {
     FcitxQtInputContextProxy *proxy = validICByWindow(lastWindow_);
     commitPreedit(lastObject_);
     if (proxy) {
-        proxy->focusOut();
         FcitxQtICData &data = *static_cast<FcitxQtICData *>(
             proxy->property("icData").value<void *>());
+        // Send focus out right away, so it always arrives before focus in of
+        // the next input context.
+        setICFocus(data, false);
+        flushState(data);
         data.resetCandidateWindow();
     }
 
     QWindow *window = focusWindowWrapper();
     lastWindow_ = window;
     lastObject_ = realFocusObject;
-    // Always create IC Data for window.
     if (window) {
         proxy = validICByWindow(window);
         if (!proxy) {
-            createICData(window);
+            ensureICData(window);
+            // A shared input context may be ready right away.
+            proxy = validICByWindow(window);
         }
     }
     if (!window) {
@@ -509,7 +720,9 @@ void QFcitxPlatformInputContext::setFocusObject(QObject *object) {
     }
 
     if (proxy) {
-        proxy->focusIn();
+        setICFocus(*static_cast<FcitxQtICData *>(
+                       proxy->property("icData").value<void *>()),
+                   true);
         // We need to delegate this otherwise it may cause self-recursion in
         // certain application like libreoffice.
         QMetaObject::invokeMethod(
@@ -533,7 +746,33 @@ void QFcitxPlatformInputContext::updateCursorRect() {
 
 void QFcitxPlatformInputContext::windowDestroyed(QObject *object) {
     /* access QWindow is not possible here, so we use our own map to do so */
-    icMap_.erase(static_cast<QWindow *>(object));
+    auto iter = icMap_.find(static_cast<QWindow *>(object));
+    if (iter == icMap_.end()) {
+        return;
+    }
+    if (!sharedInputContext_) {
+        icMap_.erase(iter);
+        return;
+    }
+    // Park the shared input context in the pool for the next window, so
+    // that every key of icMap_ stays a live window.
+    auto node = icMap_.extract(iter);
+    node.key() = nullptr;
+    node.mapped().setWindow(nullptr);
+    resetWindowState(node.mapped());
+    icPool_.insert(std::move(node));
+}
+
+void QFcitxPlatformInputContext::resetWindowState(FcitxQtICData &data) {
+    // Capability is queried again on focus in, and the rest is sent again
+    // once the next window reports it.
+    data.rect = QRect();
+    if (data.surroundingCursor >= 0) {
+        data.surroundingText = QString();
+        data.surroundingAnchor = -1;
+        data.surroundingCursor = -1;
+        removeCapability(data, FcitxCapabilityFlag_SurroundingText);
+    }
 }
 
 void QFcitxPlatformInputContext::cursorRectChanged() {
@@ -561,9 +800,10 @@ void QFcitxPlatformInputContext::cursorRectChanged() {
         auto margins = inputWindow->frameMargins();
         r.translate(margins.left(), margins.top());
         r = QRect(r.topLeft() * scale, r.size() * scale);
-        if (data.rect != r) {
+        if (data.rect != r || data.rectScale != scale) {
             data.rect = r;
-            proxy->setCursorRectV2(r.x(), r.y(), r.width(), r.height(), scale);
+            data.rectScale = scale;
+            markDirty(data, FcitxQtICData::Dirty_CursorRect);
         }
         return;
     }
@@ -575,8 +815,7 @@ void QFcitxPlatformInputContext::cursorRectChanged() {
 
     if (data.rect != newRect) {
         data.rect = newRect;
-        proxy->setCursorRect(newRect.x(), newRect.y(), newRect.width(),
-                             newRect.height());
+        markDirty(data, FcitxQtICData::Dirty_CursorRect);
     }
 }
 
@@ -590,13 +829,19 @@ void QFcitxPlatformInputContext::createInputContextFinished(
         static_cast<FcitxQtICData *>(proxy->property("icData").value<void *>());
     auto w = data->window();
     data->rect = QRect();
+    // This is a new input context on fcitx side, so everything need to be
+    // sent again.
+    data->serverFocused = false;
+    if (data->surroundingCursor >= 0) {
+        data->dirty |= FcitxQtICData::Dirty_SurroundingText;
+    }
 
     if (proxy->isValid()) {
         QWindow *window = focusWindowWrapper();
         setFocusGroupForX11(uuid);
         if (window && window == w) {
             cursorRectChanged();
-            proxy->focusIn();
+            setICFocus(*data, true);
         }
     }
 
@@ -617,22 +862,119 @@ void QFcitxPlatformInputContext::createInputContextFinished(
         flag |= FcitxCapabilityFlag_RelativeRect;
     }
     flag |= FcitxCapabilityFlag_ClientSideInputPanel;
+    flag |= FcitxCapabilityFlag_KeyFilter;
+    flag |= FcitxCapabilityFlag_ClientSideUIDelta;
 
     if (shouldDisableInputMethod()) {
         flag |= FcitxCapabilityFlag_Disable;
     }
 
     // Notify fcitx of the effective bits from 0bit to 40bit
-    // (FcitxCapabilityFlag_Disable)
-    data->proxy->setSupportedCapability(0x1ffffffffffull);
+    // (FcitxCapabilityFlag_Disable), FcitxCapabilityFlag_KeyFilter and
+    // FcitxCapabilityFlag_ClientSideUIDelta.
+    data->proxy->setSupportedCapability(
+        0x1ffffffffffull | FcitxCapabilityFlag_KeyFilter |
+        FcitxCapabilityFlag_ClientSideUIDelta);
 
     addCapability(*data, flag, true);
+    flushState(*data);
+}
+
+void QFcitxPlatformInputContext::setICFocus(FcitxQtICData &data, bool focus) {
+    data.focused = focus;
+    if (data.focused != data.serverFocused) {
+        markDirty(data, FcitxQtICData::Dirty_Focus);
+    }
 }
 
-void QFcitxPlatformInputContext::updateCapability(const FcitxQtICData &data) {
-    if (!data.proxy || !data.proxy->isValid())
+void QFcitxPlatformInputContext::markDirty(FcitxQtICData &data, int fields) {
+    data.dirty |= fields;
+    if (data.flushQueued) {
         return;
-    QDBusPendingReply<void> result = data.proxy->setCapability(data.capability);
+    }
+    data.flushQueued = true;
+    // proxy is owned by data, so the call is dropped if data is gone.
+    QMetaObject::invokeMethod(
+        data.proxy, [this, &data]() { flushState(data); },
+        Qt::QueuedConnection);
+}
+
+void QFcitxPlatformInputContext::flushState(FcitxQtICData &data) {
+    data.flushQueued = false;
+    if (!data.dirty || !data.proxy || !data.proxy->isValid()) {
+        return;
+    }
+    auto *proxy = data.proxy;
+    const int dirty = data.dirty;
+    data.dirty = 0;
+    data.waitForKeysSent();
+
+    if (dirty & FcitxQtICData::Dirty_Capability) {
+        proxy->setCapability(data.capability);
+    }
+    if (dirty & FcitxQtICData::Dirty_SurroundingText) {
+        proxy->setSurroundingText(data.surroundingText, data.surroundingCursor,
+                                  data.surroundingAnchor);
+    } else if (dirty & FcitxQtICData::Dirty_SurroundingTextPosition) {
+        proxy->setSurroundingTextPosition(data.surroundingCursor,
+                                          data.surroundingAnchor);
+    }
+    if ((dirty & FcitxQtICData::Dirty_CursorRect) && data.rect.isValid()) {
+        if (data.capability & FcitxCapabilityFlag_RelativeRect) {
+            proxy->setCursorRectV2(data.rect.x(), data.rect.y(),
+                                   data.rect.width(), data.rect.height(),
+                                   data.rectScale);
+        } else {
+            proxy->setCursorRect(data.rect.x(), data.rect.y(),
+                                 data.rect.width(), data.rect.height());
+        }
+    }
+    if ((dirty & FcitxQtICData::Dirty_Focus) &&
+        data.focused != data.serverFocused) {
+        if (data.focused) {
+            proxy->focusIn();
+        } else {
+            proxy->focusOut();
+        }
+        data.serverFocused = data.focused;
+    }
+}
+
+QVariantMap QFcitxPlatformInputContext::takeStateChanges(FcitxQtICData &data) {
+    QVariantMap changes;
+    const int dirty = data.dirty;
+    data.dirty = 0;
+
+    if (dirty & FcitxQtICData::Dirty_Capability) {
+        changes.insert(QStringLiteral("capability"),
+                       QVariant::fromValue<qulonglong>(data.capability));
+    }
+    if (dirty & FcitxQtICData::Dirty_SurroundingText) {
+        changes.insert(QStringLiteral("surroundingText"), data.surroundingText);
+    }
+    if (dirty & (FcitxQtICData::Dirty_SurroundingText |
+                 FcitxQtICData::Dirty_SurroundingTextPosition)) {
+        changes.insert(QStringLiteral("surroundingCursor"),
+                       QVariant::fromValue<uint>(data.surroundingCursor));
+        changes.insert(QStringLiteral("surroundingAnchor"),
+                       QVariant::fromValue<uint>(data.surroundingAnchor));
+    }
+    if ((dirty & FcitxQtICData::Dirty_CursorRect) && data.rect.isValid()) {
+        changes.insert(QStringLiteral("cursorRect"),
+                       QVariant::fromValue(QList<int>{
+                           data.rect.x(), data.rect.y(), data.rect.width(),
+                           data.rect.height()}));
+        if (data.capability & FcitxCapabilityFlag_RelativeRect) {
+            changes.insert(QStringLiteral("cursorRectScale"),
+                           static_cast<double>(data.rectScale));
+        }
+    }
+    if ((dirty & FcitxQtICData::Dirty_Focus) &&
+        data.focused != data.serverFocused) {
+        changes.insert(QStringLiteral("focus"), data.focused);
+        data.serverFocused = data.focused;
+    }
+    return changes;
 }
 
 void QFcitxPlatformInputContext::commitString(const QString &str) {
@@ -706,11 +1048,7 @@ void QFcitxPlatformInputContext::updateFormattedPreedit(
 }
 
 void QFcitxPlatformInputContext::updateClientSideUI(
-    const FcitxQtFormattedPreeditList &preedit, int cursorpos,
-    const FcitxQtFormattedPreeditList &auxUp,
-    const FcitxQtFormattedPreeditList &auxDown,
-    const FcitxQtStringKeyValueList &candidates, int candidateIndex,
-    int layoutHint, bool hasPrev, bool hasNext) {
+    const QDBusMessage &message) {
     QObject *input = qGuiApp->focusObject();
     if (!input) {
         return;
@@ -726,9 +1064,31 @@ void QFcitxPlatformInputContext::updateClientSideUI(
     auto w = data->window();
     auto window = focusWindowWrapper();
     if (window && w == window) {
-        data->candidateWindow()->updateClientSideUI(
-            preedit, cursorpos, auxUp, auxDown, candidates, candidateIndex,
-            layoutHint, hasPrev, hasNext);
+        // Nothing is decoded for windows without focus.
+        ClientSideUIView view(message);
+        data->candidateWindow()->updateClientSideUI(view);
+        // In case deltas were turned off, see updateClientSideUIHighlight.
+        addCapability(*data, FcitxCapabilityFlag_ClientSideUIDelta);
+    }
+}
+
+void QFcitxPlatformInputContext::updateClientSideUIHighlight(int candidateIndex,
+                                                             int cursorpos) {
+    FcitxQtInputContextProxy *proxy =
+        qobject_cast<FcitxQtInputContextProxy *>(sender());
+    if (!proxy) {
+        return;
+    }
+    FcitxQtICData *data =
+        static_cast<FcitxQtICData *>(proxy->property("icData").value<void *>());
+    auto window = focusWindowWrapper();
+    if (window && data->window() == window &&
+        !data->candidateWindow()->updateClientSideUIHighlight(candidateIndex,
+                                                              cursorpos)) {
+        // The candidate window is recreated since the last full update, or
+        // that update was not applied. Ask fcitx for full updates instead,
+        // which also gets the current one.
+        removeCapability(*data, FcitxCapabilityFlag_ClientSideUIDelta);
     }
 }
 
@@ -803,10 +1163,10 @@ void QFcitxPlatformInputContext::forwardKey(unsigned int keyval,
     QObject *input = qGuiApp->focusObject();
     auto window = focusWindowWrapper();
     if (input && window && w == window) {
-        std::unique_ptr<QKeyEvent> keyevent{
-            createKeyEvent(keyval, state, type, data.event.get())};
-
-        forwardEvent(window, *keyevent);
+        forwardEvent(window,
+                     createKeyEvent(keyval, state, type,
+                                    data.event.isValid() ? &data.event
+                                                         : nullptr));
     }
 }
 
@@ -823,6 +1183,10 @@ void QFcitxPlatformInputContext::updateCurrentIM(const QString &name,
 }
 
 void QFcitxPlatformInputContext::serverSideFocusOut() {
+    if (auto *proxy = qobject_cast<FcitxQtInputContextProxy *>(sender())) {
+        static_cast<FcitxQtICData *>(proxy->property("icData").value<void *>())
+            ->serverFocused = false;
+    }
     if (lastObject_ == focusObjectWrapper()) {
         commitPreedit();
     }
@@ -834,109 +1198,186 @@ bool QFcitxPlatformInputContext::hasCapability(Capability) const {
     return true;
 }
 
+void QFcitxPlatformInputContext::connectBus() {
+    if (watcher_->isWatching()) {
+        return;
+    }
+    // A connection of its own costs a socket, authentication and a Hello
+    // round trip, which applications that never take text input should not
+    // pay for.
+    watcher_->setConnection(
+        get_boolean_env("FCITX_QT_USE_SESSION_BUS", false)
+            ? QDBusConnection::sessionBus()
+            : QDBusConnection::connectToBus(QDBusConnection::SessionBus,
+                                            "fcitx"));
+    watcher_->watch();
+    if (icPoolSize_) {
+        QMetaObject::invokeMethod(
+            this, [this]() { fillICPool(); }, Qt::QueuedConnection);
+    }
+}
+
 void QFcitxPlatformInputContext::createICData(QWindow *w) {
+    connectBus();
     auto iter = icMap_.find(w);
-    if (iter == icMap_.end()) {
-        auto result =
-            icMap_.emplace(std::piecewise_construct, std::forward_as_tuple(w),
-                           std::forward_as_tuple(this, w));
+    if (iter == icMap_.end() && sharedInputContext_ && !icMap_.empty()) {
+        // Re-target the only input context instead of creating a new one.
+        // The node keeps its address, so pointers to the data stay valid.
+        auto node = icMap_.extract(icMap_.begin());
+        node.key() = w;
+        auto &data = node.mapped();
+        data.setWindow(w);
+        icMap_.insert(std::move(node));
         connect(w, &QObject::destroyed, this,
-                &QFcitxPlatformInputContext::windowDestroyed);
-        iter = result.first;
-        auto &data = iter->second;
-
-        if (QGuiApplication::platformName() == QLatin1String("xcb")) {
-            data.proxy->setDisplay("x11:");
-        } else if (QGuiApplication::platformName().startsWith("wayland")) {
-            data.proxy->setDisplay("wayland:");
+                &QFcitxPlatformInputContext::windowDestroyed,
+                Qt::UniqueConnection);
+        // What fcitx knows belongs to the old window.
+        resetWindowState(data);
+        return;
+    }
+    if (iter != icMap_.end()) {
+        return;
+    }
+    if (!icPool_.empty()) {
+        // Bind an input context from the pool, preferably one that fcitx has
+        // already created. In shared mode, it's the shared one whose window
+        // is gone.
+        auto poolIter = std::find_if(
+            icPool_.begin(), icPool_.end(),
+            [](const auto &item) { return item.second.proxy->isValid(); });
+        if (poolIter == icPool_.end()) {
+            poolIter = icPool_.begin();
         }
-        connect(data.proxy, &FcitxQtInputContextProxy::inputContextCreated,
-                this, &QFcitxPlatformInputContext::createInputContextFinished);
-        connect(data.proxy, &FcitxQtInputContextProxy::commitString, this,
-                &QFcitxPlatformInputContext::commitString);
-        connect(data.proxy, &FcitxQtInputContextProxy::forwardKey, this,
-                &QFcitxPlatformInputContext::forwardKey);
-        connect(data.proxy, &FcitxQtInputContextProxy::updateFormattedPreedit,
-                this, &QFcitxPlatformInputContext::updateFormattedPreedit);
-        connect(data.proxy, &FcitxQtInputContextProxy::deleteSurroundingText,
-                this, &QFcitxPlatformInputContext::deleteSurroundingText);
-        connect(data.proxy, &FcitxQtInputContextProxy::currentIM, this,
-                &QFcitxPlatformInputContext::updateCurrentIM);
-        connect(data.proxy, &FcitxQtInputContextProxy::updateClientSideUI, this,
-                &QFcitxPlatformInputContext::updateClientSideUI);
-        connect(data.proxy, &FcitxQtInputContextProxy::notifyFocusOut, this,
-                &QFcitxPlatformInputContext::serverSideFocusOut);
-    }
-}
-
-QKeyEvent *QFcitxPlatformInputContext::createKeyEvent(unsigned int keyval,
-                                                      unsigned int state,
-                                                      bool isRelease,
-                                                      const QKeyEvent *event) {
-    QKeyEvent *newEvent = nullptr;
+        auto node = icPool_.extract(poolIter);
+        node.key() = w;
+        node.mapped().setWindow(w);
+        icMap_.insert(std::move(node));
+        connect(w, &QObject::destroyed, this,
+                &QFcitxPlatformInputContext::windowDestroyed,
+                Qt::UniqueConnection);
+        QMetaObject::invokeMethod(
+            this, [this]() { fillICPool(); }, Qt::QueuedConnection);
+        return;
+    }
+    auto result =
+        icMap_.emplace(std::piecewise_construct, std::forward_as_tuple(w),
+                       std::forward_as_tuple(this, w));
+    connect(w, &QObject::destroyed, this,
+            &QFcitxPlatformInputContext::windowDestroyed);
+    setupICData(result.first->second);
+}
+
+void QFcitxPlatformInputContext::fillICPool() {
+    // A shared input context never needs another one. Others wait for the
+    // bus, see connectBus.
+    if (destroy_ || sharedInputContext_ || !watcher_->isWatching()) {
+        return;
+    }
+    while (icPool_.size() < icPoolSize_) {
+        auto iter = icPool_.emplace(std::piecewise_construct,
+                                    std::forward_as_tuple(nullptr),
+                                    std::forward_as_tuple(this, nullptr));
+        setupICData(iter->second);
+    }
+}
+
+void QFcitxPlatformInputContext::setupICData(FcitxQtICData &data) {
+    if (QGuiApplication::platformName() == QLatin1String("xcb")) {
+        data.proxy->setDisplay("x11:");
+    } else if (QGuiApplication::platformName().startsWith("wayland")) {
+        data.proxy->setDisplay("wayland:");
+    }
+    connect(data.proxy, &FcitxQtInputContextProxy::inputContextCreated, this,
+            &QFcitxPlatformInputContext::createInputContextFinished);
+    connect(data.proxy, &FcitxQtInputContextProxy::commitString, this,
+            &QFcitxPlatformInputContext::commitString);
+    connect(data.proxy, &FcitxQtInputContextProxy::forwardKey, this,
+            &QFcitxPlatformInputContext::forwardKey);
+    connect(data.proxy, &FcitxQtInputContextProxy::updateFormattedPreedit,
+            this, &QFcitxPlatformInputContext::updateFormattedPreedit);
+    connect(data.proxy, &FcitxQtInputContextProxy::deleteSurroundingText,
+            this, &QFcitxPlatformInputContext::deleteSurroundingText);
+    connect(data.proxy, &FcitxQtInputContextProxy::currentIM, this,
+            &QFcitxPlatformInputContext::updateCurrentIM);
+    connect(data.proxy, &FcitxQtInputContextProxy::updateClientSideUIMessage,
+            this, &QFcitxPlatformInputContext::updateClientSideUI);
+    connect(data.proxy, &FcitxQtInputContextProxy::updateClientSideUIHighlight,
+            this, &QFcitxPlatformInputContext::updateClientSideUIHighlight);
+    connect(data.proxy, &FcitxQtInputContextProxy::notifyFocusOut, this,
+            &QFcitxPlatformInputContext::serverSideFocusOut);
+}
+
+void QFcitxPlatformInputContext::ensureICData(QWindow *window) {
+    // Creation is asynchronous, so it's done by the time the user starts
+    // typing.
+    if (!deferInputContext_ || !shouldDisableInputMethod()) {
+        createICData(window);
+        prepareCompose();
+    }
+}
+
+KeyEventRecord
+QFcitxPlatformInputContext::createKeyEvent(unsigned int keyval,
+                                           unsigned int state, bool isRelease,
+                                           const KeyEventRecord *event) {
     state &= (~(1u << 31));
-    if (event && event->nativeVirtualKey() == keyval &&
-        event->nativeModifiers() == state &&
-        isRelease == (event->type() == QEvent::KeyRelease)) {
-#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-        newEvent = new QKeyEvent(
-            event->type(), event->key(), event->modifiers(),
-            event->nativeScanCode(), event->nativeVirtualKey(),
-            event->nativeModifiers(), event->text(), event->isAutoRepeat(),
-            event->count(), event->device());
-#else
-        newEvent = new QKeyEvent(*event);
-#endif
-    } else {
-        Qt::KeyboardModifiers qstate = Qt::NoModifier;
+    if (event && event->nativeVirtualKey == keyval &&
+        event->nativeModifiers == state &&
+        isRelease == (event->type == QEvent::KeyRelease)) {
+        return *event;
+    }
 
-        int count = 1;
-        if (state & FcitxKeyState_Alt) {
-            qstate |= Qt::AltModifier;
-            count++;
-        }
+    KeyEventRecord newEvent;
+    Qt::KeyboardModifiers qstate = Qt::NoModifier;
 
-        if (state & FcitxKeyState_Shift) {
-            qstate |= Qt::ShiftModifier;
-            count++;
-        }
+    int count = 1;
+    if (state & FcitxKeyState_Alt) {
+        qstate |= Qt::AltModifier;
+        count++;
+    }
 
-        if (state & FcitxKeyState_Ctrl) {
-            qstate |= Qt::ControlModifier;
-            count++;
-        }
+    if (state & FcitxKeyState_Shift) {
+        qstate |= Qt::ShiftModifier;
+        count++;
+    }
 
-        char32_t unicode = xkb_keysym_to_utf32(keyval);
-        QString text;
-        if (unicode) {
-            text = QString::fromUcs4(&unicode, 1);
-        }
+    if (state & FcitxKeyState_Ctrl) {
+        qstate |= Qt::ControlModifier;
+        count++;
+    }
 
-        int key = keysymToQtKey(keyval, text);
+    char32_t unicode = xkb_keysym_to_utf32(keyval);
+    QString text;
+    if (unicode) {
+        text = QString::fromUcs4(&unicode, 1);
+    }
 
-        newEvent =
-            new QKeyEvent(isRelease ? (QEvent::KeyRelease) : (QEvent::KeyPress),
-                          key, qstate, 0, keyval, state, text, false, count);
-        if (event) {
-            newEvent->setTimestamp(event->timestamp());
-        }
+    newEvent.type = isRelease ? (QEvent::KeyRelease) : (QEvent::KeyPress);
+    newEvent.key = keysymToQtKey(keyval, text);
+    newEvent.modifiers = qstate;
+    newEvent.nativeVirtualKey = keyval;
+    newEvent.nativeModifiers = state;
+    newEvent.text = text;
+    newEvent.count = count;
+    if (event) {
+        newEvent.timestamp = event->timestamp;
     }
 
     return newEvent;
 }
 
 void QFcitxPlatformInputContext::forwardEvent(QWindow *window,
-                                              const QKeyEvent &keyEvent) {
+                                              const KeyEventRecord &keyEvent) {
     // use same variable name as in QXcbKeyboard::handleKeyEvent
-    QEvent::Type type = keyEvent.type();
-    int qtcode = keyEvent.key();
-    Qt::KeyboardModifiers modifiers = keyEvent.modifiers();
-    quint32 code = keyEvent.nativeScanCode();
-    quint32 sym = keyEvent.nativeVirtualKey();
-    quint32 state = keyEvent.nativeModifiers();
-    QString string = keyEvent.text();
-    bool isAutoRepeat = keyEvent.isAutoRepeat();
-    ulong time = keyEvent.timestamp();
+    QEvent::Type type = keyEvent.type;
+    int qtcode = keyEvent.key;
+    Qt::KeyboardModifiers modifiers = keyEvent.modifiers;
+    quint32 code = keyEvent.nativeScanCode;
+    quint32 sym = keyEvent.nativeVirtualKey;
+    quint32 state = keyEvent.nativeModifiers;
+    const QString &string = keyEvent.text;
+    bool isAutoRepeat = keyEvent.isAutoRepeat;
+    ulong time = keyEvent.timestamp;
     // copied from QXcbKeyboard::handleKeyEvent()
     if (type == QEvent::KeyPress && qtcode == Qt::Key_Menu) {
         QPoint globalPos, pos;
@@ -947,9 +1388,9 @@ void QFcitxPlatformInputContext::forwardEvent(QWindow *window,
         QWindowSystemInterface::handleContextMenuEvent(window, false, pos,
                                                        globalPos, modifiers);
     }
-    QWindowSystemInterface::handleExtendedKeyEvent(window, time, type, qtcode,
-                                                   modifiers, code, sym, state,
-                                                   string, isAutoRepeat);
+    QWindowSystemInterface::handleExtendedKeyEvent(
+        window, time, type, qtcode, modifiers, code, sym, state, string,
+        isAutoRepeat, static_cast<ushort>(keyEvent.count));
 }
 
 bool QFcitxPlatformInputContext::filterEvent(const QEvent *event) {
@@ -959,6 +1400,13 @@ bool QFcitxPlatformInputContext::filterEvent(const QEvent *event) {
             break;
         }
 
+        // A key sent while waiting for the reply of an earlier one, e.g. by
+        // a timer, would be handled in the middle of that one. Leave it to
+        // the application.
+        if (Q_UNLIKELY(waitingKeyReply_)) {
+            break;
+        }
+
         const QKeyEvent *keyEvent = static_cast<const QKeyEvent *>(event);
         quint32 keyval = keyEvent->nativeVirtualKey();
         quint32 keycode = keyEvent->nativeScanCode();
@@ -976,6 +1424,16 @@ bool QFcitxPlatformInputContext::filterEvent(const QEvent *event) {
 
         FcitxQtInputContextProxy *proxy = validICByWindow(focusWindowWrapper());
 
+        if (!proxy) {
+            // The input context is only needed now, the key is handled
+            // locally while it's being created. One from the pool may take
+            // the key right away.
+            if (auto *window = focusWindowWrapper()) {
+                createICData(window);
+                proxy = validICByWindow(window);
+            }
+        }
+
         if (!proxy) {
             if (filterEventFallback(keyval, keycode, state, isRelease)) {
                 return true;
@@ -984,19 +1442,74 @@ bool QFcitxPlatformInputContext::filterEvent(const QEvent *event) {
             }
         }
 
-        update(Qt::ImHints | Qt::ImEnabled);
-        proxy->focusIn();
+        FcitxQtICData &data = *static_cast<FcitxQtICData *>(
+            proxy->property("icData").value<void *>());
 
         auto stateToFcitx = state;
         if (keyEvent->isAutoRepeat()) {
             // KeyState::Repeat
             stateToFcitx |= (1u << 31);
+            // Do not let repeats pile up if fcitx is slow.
+            if (coalesceKeyRepeat(data, *keyEvent)) {
+                return true;
+            }
+        }
+
+        // fcitx is not interested in this key, handle it locally without
+        // asking fcitx, or querying the state that only fcitx needs.
+        if (!proxy->wantsKey(keyval, state)) {
+            if (data.pendingKeys.empty()) {
+                if (filterEventFallback(keyval, keycode, state, isRelease)) {
+                    return true;
+                } else {
+                    break;
+                }
+            }
+            // Keys sent earlier are still pending, queue it after them to
+            // keep the order.
+            if (data.pendingKeys.full() && !waitForOldestKey(data)) {
+                break;
+            }
+            auto &entry = data.pendingKeys.slot(data.pendingKeys.push());
+            entry.event.set(*keyEvent);
+            entry.window = focusWindowWrapper();
+            entry.finished = true;
+            entry.passthrough = true;
+            processPendingKeys(data);
+            return true;
+        }
+
+        // Only a key press may start typing, the release of it is sent with
+        // the hints already refreshed.
+        if (keyEvent->type() == QEvent::KeyPress) {
+            update(Qt::ImHints | Qt::ImEnabled);
         }
-        auto reply = proxy->processKeyEvent(keyval, keycode, stateToFcitx,
-                                            isRelease, keyEvent->timestamp());
+        setICFocus(data, true);
+
+        // Make sure fcitx sees the latest state before the key, sent along
+        // with the key if fcitx supports it.
+        const bool withState = proxy->supportProcessKeyEventWithState();
+
+        const bool trackLatency =
+            keyLatencyInterval_ || keyLatencyReportOnExit_;
 
         if (Q_UNLIKELY(syncMode_)) {
+            if (!withState) {
+                flushState(data);
+            }
+            std::chrono::steady_clock::time_point sentTime;
+            if (trackLatency) {
+                sentTime = std::chrono::steady_clock::now();
+            }
+            auto reply =
+                withState ? proxy->processKeyEventWithState(
+                                takeStateChanges(data), keyval, keycode,
+                                stateToFcitx, isRelease, keyEvent->timestamp())
+                          : proxy->processKeyEvent(keyval, keycode,
+                                                   stateToFcitx, isRelease,
+                                                   keyEvent->timestamp());
             reply.waitForFinished();
+            recordKeyLatency(data, sentTime);
 
             if (reply.isError() || !reply.value()) {
                 if (filterEventFallback(keyval, keycode, state, isRelease)) {
@@ -1008,71 +1521,265 @@ bool QFcitxPlatformInputContext::filterEvent(const QEvent *event) {
                 update(Qt::ImCursorRectangle);
                 return true;
             }
+        }
+
+        // Do not let keys pile up if fcitx is slow, wait for the oldest key
+        // instead. Leave the key to the application if the input context is
+        // gone meanwhile.
+        if (data.pendingKeys.full() && !waitForOldestKey(data)) {
+            break;
+        }
+        if (!withState) {
+            flushState(data);
+        }
+        // Queuing the key and handling its reply reuse the slot, but a key
+        // still allocates for the query events of update(), the state
+        // changes if there are any, and the D-Bus message with its
+        // arguments. bench-keypath reports the count.
+        const size_t index = data.pendingKeys.push();
+        auto &entry = data.pendingKeys.slot(index);
+        entry.event.set(*keyEvent);
+        entry.window = focusWindowWrapper();
+        if (trackLatency) {
+            entry.sentTime = std::chrono::steady_clock::now();
+        }
+        auto *receiver = data.keyReceivers[index].get();
+        bool sent = true;
+        if (!data.keyForwarders.empty()) {
+            // Marshalling, I/O and demarshalling of the reply happen in the
+            // key event thread, the reply is posted back to receiver.
+            auto message =
+                withState ? proxy->processKeyEventWithStateMessage(
+                                takeStateChanges(data), keyval, keycode,
+                                stateToFcitx, isRelease, keyEvent->timestamp())
+                          : proxy->processKeyEventMessage(
+                                keyval, keycode, stateToFcitx, isRelease,
+                                keyEvent->timestamp());
+            auto *forwarder = data.keyForwarders[index];
+            data.keyReplyTarget->unsent++;
+            QMetaObject::invokeMethod(
+                forwarder,
+                [forwarder, connection = proxy->connection(), message]() {
+                    forwarder->send(connection, message);
+                },
+                Qt::QueuedConnection);
         } else {
-            ProcessKeyWatcher *watcher = new ProcessKeyWatcher(
-                *keyEvent, focusWindowWrapper(), reply, proxy);
-            connect(watcher, &QDBusPendingCallWatcher::finished, this,
-                    &QFcitxPlatformInputContext::processKeyEventFinished);
+            sent = withState ? proxy->processKeyEventWithState(
+                                   takeStateChanges(data), keyval, keycode,
+                                   stateToFcitx, isRelease,
+                                   keyEvent->timestamp(), receiver,
+                                   SLOT(finished(bool)),
+                                   SLOT(error(QDBusError)))
+                             : proxy->processKeyEvent(
+                                   keyval, keycode, stateToFcitx, isRelease,
+                                   keyEvent->timestamp(), receiver,
+                                   SLOT(finished(bool)),
+                                   SLOT(error(QDBusError)));
+        }
+        if (!sent) {
+            entry.finished = true;
+            entry.error = true;
+            processPendingKeys(data);
             return true;
         }
+
+        // If there is no earlier key, try to get the reply within the
+        // deadline, so the key does not need to be forwarded again later.
+        if (syncDeadline_.count() && data.pendingKeys.size() == 1) {
+            QPointer<FcitxQtICData> guard(&data);
+            const bool replied = waitForKeyReply(data, index, syncDeadline_);
+            if (!guard) {
+                break;
+            }
+            if (replied) {
+                const KeyEventQueue::Entry result = data.pendingKeys.front();
+                data.pendingKeys.pop();
+                if (!result.error) {
+                    update(Qt::ImCursorRectangle);
+                }
+                if (result.error || !result.filtered) {
+                    if (filterEventFallback(keyval, keycode, state,
+                                            isRelease)) {
+                        return true;
+                    } else {
+                        break;
+                    }
+                }
+                data.event = result.event;
+                return true;
+            }
+            // fcitx is too slow, the reply will be handled asynchronously.
+        }
+        return true;
     } while (0);
     return QPlatformInputContext::filterEvent(event);
 }
 
-void QFcitxPlatformInputContext::processKeyEventFinished(
-    QDBusPendingCallWatcher *w) {
-    ProcessKeyWatcher *watcher = static_cast<ProcessKeyWatcher *>(w);
-    QDBusPendingReply<bool> result(*watcher);
+bool QFcitxPlatformInputContext::coalesceKeyRepeat(FcitxQtICData &data,
+                                                   const QKeyEvent &keyEvent) {
+    if (repeatCoalesce_ == KeyRepeatCoalesce::None ||
+        data.pendingKeys.empty()) {
+        return false;
+    }
+    // Auto repeat comes as pairs of release and press, both are merged into
+    // the last repeated press that is not handled yet.
+    auto &last = data.pendingKeys.back();
+    if (!last.event.isAutoRepeat || last.event.type != QEvent::KeyPress ||
+        last.event.nativeVirtualKey != keyEvent.nativeVirtualKey() ||
+        last.event.nativeModifiers != keyEvent.nativeModifiers()) {
+        return false;
+    }
+    // A key filtered by fcitx would lose the repeats merged into it, so
+    // those are only dropped.
+    if (repeatCoalesce_ == KeyRepeatCoalesce::Merge && last.passthrough &&
+        keyEvent.type() == QEvent::KeyPress) {
+        last.mergedRepeats++;
+    }
+    return true;
+}
+
+bool QFcitxPlatformInputContext::waitForOldestKey(FcitxQtICData &data) {
+    QPointer<FcitxQtICData> guard(&data);
+    const size_t index = data.pendingKeys.frontIndex();
+    if (!waitForKeyReply(data, index, keyReplyTimeout_)) {
+        if (!guard) {
+            return false;
+        }
+        // Don't let a stuck fcitx freeze the application, handle the key
+        // locally as if the call failed.
+        auto &entry = data.pendingKeys.slot(index);
+        entry.finished = true;
+        entry.error = true;
+        data.keyReceivers[index]->ignoreReply();
+    }
+    processPendingKeys(data);
+    return guard;
+}
+
+bool QFcitxPlatformInputContext::waitForKeyReply(
+    FcitxQtICData &data, size_t index, std::chrono::milliseconds timeout) {
+    auto &entry = data.pendingKeys.slot(index);
+    auto *receiver = data.keyReceivers[index].get();
+    // The reply is read by QtDBus's own thread, or the key event thread, and
+    // posted to the receiver, it may be there already.
+    QCoreApplication::sendPostedEvents(receiver);
+    if (entry.finished) {
+        return true;
+    }
+    QPointer<FcitxQtICData> guard(&data);
+    QEventLoop loop;
+    QTimer timer;
+    timer.setSingleShot(true);
+    connect(&timer, &QTimer::timeout, &loop, &QEventLoop::quit);
+    connect(receiver, &ProcessKeyReceiver::replied, &loop, &QEventLoop::quit);
+    connect(&data, &QObject::destroyed, &loop, &QEventLoop::quit);
+    timer.start(timeout);
+    // The key is half filtered until the caller handles the reply, so
+    // nothing else may handle keys in the meantime: the receivers leave the
+    // replies of data to the caller, and filterEvent takes no new key.
+    const bool wasWaiting = data.waitingKeyReply;
+    data.waitingKeyReply = true;
+    waitingKeyReply_ = true;
+    // Sleeps until something is posted to this thread. Neither user input
+    // nor the window system is read, so no other key can get in front of
+    // this one.
+    loop.exec(QEventLoop::ExcludeUserInputEvents |
+              QEventLoop::ExcludeSocketNotifiers);
+    waitingKeyReply_ = false;
+    if (!guard) {
+        return false;
+    }
+    data.waitingKeyReply = wasWaiting;
+    return entry.finished;
+}
+
+void QFcitxPlatformInputContext::processPendingKeys(FcitxQtICData &data) {
+    // A reply may arrive before the reply of an earlier key, in that case it
+    // will be handled once all the earlier keys are finished.
+    while (!data.pendingKeys.empty() && data.pendingKeys.front().finished) {
+        // Pop before handling it, since handling the key may reach here again.
+        const KeyEventQueue::Entry entry = data.pendingKeys.front();
+        data.pendingKeys.pop();
+        finishKeyEvent(data, entry);
+    }
+}
+
+void QFcitxPlatformInputContext::recordKeyLatency(
+    FcitxQtICData &data, std::chrono::steady_clock::time_point sentTime) {
+    if (!keyLatencyInterval_ && !keyLatencyReportOnExit_) {
+        return;
+    }
+    auto usec = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - sentTime)
+                    .count();
+    data.keyLatency.record(usec);
+    keyLatency_.record(usec);
+}
+
+void QFcitxPlatformInputContext::reportKeyLatency() {
+    if (!keyLatency_.count()) {
+        return;
+    }
+    qCInfo(fcitx5qtKeyLatency).noquote()
+        << "Key latency of process:" << keyLatency_.summary();
+    for (auto &[window, data] : icMap_) {
+        if (!data.keyLatency.count()) {
+            continue;
+        }
+        qCInfo(fcitx5qtKeyLatency).noquote()
+            << "Key latency of window" << window->title() << ":"
+            << data.keyLatency.summary();
+        data.keyLatency.reset();
+    }
+    // Each periodic summary only covers the keys since the last one.
+    keyLatency_.reset();
+}
+
+void QFcitxPlatformInputContext::finishKeyEvent(
+    FcitxQtICData &data, const KeyEventQueue::Entry &entry) {
     bool filtered = false;
 
-    QWindow *window = watcher->window();
+    QWindow *window = entry.window.data();
     // if window is already destroyed, we can only throw this event away.
     if (!window) {
-        delete watcher;
         return;
     }
 
-    const QKeyEvent &keyEvent = watcher->keyEvent();
+    const KeyEventRecord &keyEvent = entry.event;
 
     // use same variable name as in QXcbKeyboard::handleKeyEvent
-    QEvent::Type type = keyEvent.type();
-    quint32 code = keyEvent.nativeScanCode();
-    quint32 sym = keyEvent.nativeVirtualKey();
-    quint32 state = keyEvent.nativeModifiers();
-    QString string = keyEvent.text();
+    QEvent::Type type = keyEvent.type;
+    quint32 code = keyEvent.nativeScanCode;
+    quint32 sym = keyEvent.nativeVirtualKey;
+    quint32 state = keyEvent.nativeModifiers;
 
-    if (result.isError() || !result.value()) {
+    if (entry.error || !entry.filtered) {
         filtered =
             filterEventFallback(sym, code, state, type == QEvent::KeyRelease);
     } else {
         filtered = true;
     }
 
-    if (!watcher->isError()) {
+    // Nothing changed on the side of fcitx for a key it never saw.
+    if (!entry.error && !entry.passthrough) {
         update(Qt::ImCursorRectangle);
     }
 
     if (!filtered) {
-        forwardEvent(window, keyEvent);
-    } else {
-        auto proxy =
-            qobject_cast<FcitxQtInputContextProxy *>(watcher->parent());
-        if (proxy) {
-            FcitxQtICData &data = *static_cast<FcitxQtICData *>(
-                proxy->property("icData").value<void *>());
-#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-            data.event = std::make_unique<QKeyEvent>(
-                keyEvent.type(), keyEvent.key(), keyEvent.modifiers(),
-                keyEvent.nativeScanCode(), keyEvent.nativeVirtualKey(),
-                keyEvent.nativeModifiers(), keyEvent.text(),
-                keyEvent.isAutoRepeat(), keyEvent.count(), keyEvent.device());
-#else
-            data.event = std::make_unique<QKeyEvent>(keyEvent);
-#endif
+        if (entry.mergedRepeats) {
+            // Only merged into keys fcitx never sees, which are handled by
+            // the application unless compose takes them. Delivered as one
+            // event, the same as Qt::WA_KeyCompression does.
+            KeyEventRecord merged = keyEvent;
+            merged.count += entry.mergedRepeats;
+            merged.text = keyEvent.text.repeated(merged.count);
+            forwardEvent(window, merged);
+        } else {
+            forwardEvent(window, keyEvent);
         }
+    } else if (!entry.passthrough) {
+        data.event = keyEvent;
     }
-
-    delete watcher;
 }
 
 bool QFcitxPlatformInputContext::filterEventFallback(unsigned int keyval,
@@ -1118,10 +1825,30 @@ bool QFcitxPlatformInputContext::processCompose(unsigned int keyval,
                                                 bool isRelease) {
     Q_UNUSED(state);
 
-    if (!xkbComposeTable_ || isRelease)
+    if (isRelease)
         return false;
 
+    ensureCompose();
+    if (composeCache_) {
+        switch (composeCache_->feed(keyval)) {
+        case ComposeCache::Status::Ignored:
+        case ComposeCache::Status::Nothing:
+            return false;
+        case ComposeCache::Status::Composed:
+            if (!composeCache_->text().isEmpty()) {
+                commitString(composeCache_->text());
+            }
+            break;
+        case ComposeCache::Status::Composing:
+        case ComposeCache::Status::Cancelled:
+            break;
+        }
+        return true;
+    }
+
     struct xkb_compose_state *xkbComposeState = xkbComposeState_.data();
+    if (!xkbComposeState)
+        return false;
 
     enum xkb_compose_feed_result result =
         xkb_compose_state_feed(xkbComposeState, keyval);
@@ -1148,6 +1875,57 @@ bool QFcitxPlatformInputContext::processCompose(unsigned int keyval,
     return true;
 }
 
+void QFcitxPlatformInputContext::prepareCompose() {
+    if (composeReady_ || composeFuture_.valid()) {
+        return;
+    }
+    // The table holds a reference to the context, and nothing else uses
+    // either of them until the table is handed over by the future. A cache
+    // compiled by an earlier run, or another process, saves compiling the
+    // table at all, and is shared with other processes.
+    composeFuture_ = std::async(
+        std::launch::async,
+        [locale = QString::fromLocal8Bit(get_locale()),
+         useCache = get_boolean_env("FCITX_QT_COMPOSE_CACHE", true),
+         cancelled = &composeCancelled_]() {
+            CompiledCompose result;
+            if (*cancelled ||
+                (useCache && (result.cache = ComposeCache::open(locale)))) {
+                return result;
+            }
+            QScopedPointer<struct xkb_context, XkbContextDeleter> context(
+                _xkb_context_new_helper());
+            if (!context || *cancelled) {
+                return result;
+            }
+            result.table = xkb_compose_table_new_from_locale(
+                context.data(), locale.toLocal8Bit().constData(),
+                XKB_COMPOSE_COMPILE_NO_FLAGS);
+            if (useCache && result.table && !*cancelled &&
+                ComposeCache::build(locale, result.table) &&
+                (result.cache = ComposeCache::open(locale))) {
+                xkb_compose_table_unref(result.table);
+                result.table = nullptr;
+            }
+            return result;
+        });
+}
+
+void QFcitxPlatformInputContext::ensureCompose() {
+    if (composeReady_) {
+        return;
+    }
+    prepareCompose();
+    auto compiled = composeFuture_.get();
+    composeCache_ = std::move(compiled.cache);
+    xkbComposeTable_.reset(compiled.table);
+    if (xkbComposeTable_) {
+        xkbComposeState_.reset(xkb_compose_state_new(
+            xkbComposeTable_.data(), XKB_COMPOSE_STATE_NO_FLAGS));
+    }
+    composeReady_ = true;
+}
+
 QWindow *QFcitxPlatformInputContext::focusWindowWrapper() const {
     QWindow *focusWindow = qGuiApp->focusWindow();
     do {
@@ -8,26 +8,84 @@
 #ifndef QFCITXPLATFORMINPUTCONTEXT_H
 #define QFCITXPLATFORMINPUTCONTEXT_H
 
+#include "composecache.h"
 #include "fcitxcandidatewindow.h"
 #include "fcitxqtinputcontextproxy.h"
 #include "fcitxqtwatcher.h"
+#include "keyeventqueue.h"
+#include "keyeventworker.h"
+#include "latencyhistogram.h"
 #include <QDBusConnection>
+#include <QDBusError>
 #include <QDBusServiceWatcher>
 #include <QGuiApplication>
 #include <QKeyEvent>
+#include <QLoggingCategory>
 #include <QPointer>
 #include <QRect>
+#include <QThread>
 #include <QWindow>
+#include <atomic>
+#include <future>
 #include <memory>
 #include <qpa/qplatforminputcontext.h>
 #include <unordered_map>
+#include <vector>
 #include <xkbcommon/xkbcommon-compose.h>
 
 namespace fcitx {
 
+Q_DECLARE_LOGGING_CATEGORY(fcitx5qtKeyLatency)
+
 class FcitxQtConnection;
+class FcitxQtICData;
+
+// What to do with an auto repeated key while an earlier repeat of the same
+// key is still waiting for fcitx.
+enum class KeyRepeatCoalesce {
+    // Send every repeat to fcitx.
+    None,
+    // Discard the new repeat.
+    Drop,
+    // Fold the new repeat into the earlier one, which reaches the application
+    // as a single event with the number of repeats as its count. fcitx has
+    // no way to take a count, so repeats of keys it wants are dropped
+    // instead, which keeps at most one of them waiting for fcitx.
+    Merge,
+};
 class QFcitxPlatformInputContext;
 
+// Receives the reply of ProcessKeyEvent for one slot of the key queue. These
+// are created along with the queue and reused for every key.
+class ProcessKeyReceiver : public QObject {
+    Q_OBJECT
+public:
+    ProcessKeyReceiver(QFcitxPlatformInputContext *context,
+                       FcitxQtICData *data, size_t index)
+        : context_(context), data_(data), index_(index) {}
+
+    bool event(QEvent *event) override;
+
+    // The reply of the key that is pending in this slot is dropped, since
+    // the key is already handled without it.
+    void ignoreReply() { staleReplies_++; }
+
+public Q_SLOTS:
+    void finished(bool filtered);
+    void error(const QDBusError &error);
+
+Q_SIGNALS:
+    void replied();
+
+private:
+    bool takeStaleReply();
+
+    QFcitxPlatformInputContext *context_;
+    FcitxQtICData *data_;
+    size_t index_;
+    int staleReplies_ = 0;
+};
+
 class FcitxQtICData : public QObject {
 public:
     FcitxQtICData(QFcitxPlatformInputContext *context, QWindow *window);
@@ -37,49 +95,64 @@ public:
     FcitxCandidateWindow *candidateWindow();
 
     QWindow *window() { return window_.data(); }
+    // Move the input context to another window, used when one input context
+    // is shared by all windows.
+    void setWindow(QWindow *window);
 
     void resetCandidateWindow();
+    // Calls other than keys are made from the GUI thread. Must be called
+    // before any of them, so that they reach fcitx after the keys the key
+    // event thread is about to send.
+    void waitForKeysSent();
 
     quint64 capability = 0;
+    // State that may be out of sync with fcitx, see
+    // QFcitxPlatformInputContext::flushState.
+    enum DirtyState {
+        Dirty_Focus = (1 << 0),
+        Dirty_Capability = (1 << 1),
+        Dirty_CursorRect = (1 << 2),
+        Dirty_SurroundingText = (1 << 3),
+        Dirty_SurroundingTextPosition = (1 << 4),
+    };
+
     FcitxQtInputContextProxy *proxy;
     QRect rect;
+    qreal rectScale = 1.0;
+    bool focused = false;
+    // Whether fcitx thinks this input context has focus.
+    bool serverFocused = false;
+    int dirty = 0;
+    bool flushQueued = false;
     // Last key event forwarded.
-    std::unique_ptr<QKeyEvent> event;
+    KeyEventRecord event;
     QString surroundingText;
     int surroundingAnchor = -1;
     int surroundingCursor = -1;
     bool expectingMicroFocusChange = false;
+    // Set while waitForKeyReply waits for a key of this input context,
+    // replies are not handled by the receivers in the meantime.
+    bool waitingKeyReply = false;
+    // Keys sent to fcitx that are not handled yet, oldest first. Replies are
+    // always handled in this order, even if they arrive out of order.
+    KeyEventQueue pendingKeys;
+    std::vector<std::unique_ptr<ProcessKeyReceiver>> keyReceivers;
+    // Only used with the key event thread, one per slot of pendingKeys.
+    std::shared_ptr<KeyReplyTarget> keyReplyTarget;
+    std::vector<KeyReplyForwarder *> keyForwarders;
+    // Time between sending a key and receiving its reply.
+    LatencyHistogram keyLatency;
     bool eventFilter(QObject *watched, QEvent *event) override;
 
 private:
+    void attachWindow(QWindow *window);
+
     QFcitxPlatformInputContext *context_;
     QPointer<QWindow> window_;
+    QMetaObject::Connection visibilityConnection_;
     QPointer<FcitxCandidateWindow> candidateWindow_;
 };
 
-class ProcessKeyWatcher : public QDBusPendingCallWatcher {
-    Q_OBJECT
-public:
-    ProcessKeyWatcher(const QKeyEvent &event, QWindow *window,
-                      const QDBusPendingCall &call, QObject *parent = 0)
-        : QDBusPendingCallWatcher(call, parent),
-          event_(event.type(), event.key(), event.modifiers(),
-                 event.nativeScanCode(), event.nativeVirtualKey(),
-                 event.nativeModifiers(), event.text(), event.isAutoRepeat(),
-                 event.count()),
-          window_(window) {}
-
-    virtual ~ProcessKeyWatcher() {}
-
-    const QKeyEvent &keyEvent() { return event_; }
-
-    QWindow *window() { return window_.data(); }
-
-private:
-    QKeyEvent event_;
-    QPointer<QWindow> window_;
-};
-
 struct XkbContextDeleter {
     static inline void cleanup(struct xkb_context *pointer) {
         if (pointer)
@@ -101,6 +174,14 @@ struct XkbComposeStateDeleter {
     }
 };
 
+// What prepareCompose() compiles, only one of them is set.
+struct CompiledCompose {
+    // Mapped from the user cache directory.
+    std::unique_ptr<ComposeCache> cache;
+    // Fallback if the cache can't be built.
+    struct xkb_compose_table *table = nullptr;
+};
+
 class QFcitxPlatformInputContext : public QPlatformInputContext {
     Q_OBJECT
 public:
@@ -118,6 +199,8 @@ public:
     bool hasCapability(Capability capability) const override;
 
     FcitxQtWatcher *watcher() { return watcher_; }
+    size_t maxPendingKeys() const { return maxPendingKeys_; }
+    QThread *keyThread() const { return keyThread_; }
 
     // Use Wrapper as suffix to avoid upstream add function with same name.
     QObject *focusObjectWrapper() const;
@@ -140,31 +223,31 @@ public Q_SLOTS:
     void windowDestroyed(QObject *object);
     void updateCurrentIM(const QString &name, const QString &uniqueName,
                          const QString &langCode);
-    void updateClientSideUI(const FcitxQtFormattedPreeditList &preedit,
-                            int cursorpos,
-                            const FcitxQtFormattedPreeditList &auxUp,
-                            const FcitxQtFormattedPreeditList &auxDown,
-                            const FcitxQtStringKeyValueList &candidates,
-                            int candidateIndex, int layoutHint, bool hasPrev,
-                            bool hasNext);
+    void updateClientSideUI(const QDBusMessage &message);
+    void updateClientSideUIHighlight(int candidateIndex, int cursorpos);
     void serverSideFocusOut();
     bool commitPreedit(QPointer<QObject> input = qApp->focusObject());
-private Q_SLOTS:
-    void processKeyEventFinished(QDBusPendingCallWatcher *);
 
 private:
+    friend class ProcessKeyReceiver;
+
     bool processCompose(unsigned int keyval, unsigned int state,
                         bool isRelaese);
-    QKeyEvent *createKeyEvent(unsigned int keyval, unsigned int state,
-                              bool isRelaese, const QKeyEvent *event);
-    void forwardEvent(QWindow *window, const QKeyEvent &event);
+    // Start compiling the compose table in the background.
+    void prepareCompose();
+    // Waits for the compilation if it's not done yet. Sets either
+    // composeCache_ or xkbComposeState_, or none if there is no table.
+    void ensureCompose();
+    KeyEventRecord createKeyEvent(unsigned int keyval, unsigned int state,
+                                  bool isRelaese, const KeyEventRecord *event);
+    void forwardEvent(QWindow *window, const KeyEventRecord &event);
 
     void addCapability(FcitxQtICData &data, quint64 capability,
                        bool forceUpdate = false) {
         auto newcaps = data.capability | capability;
         if (data.capability != newcaps || forceUpdate) {
             data.capability = newcaps;
-            updateCapability(data);
+            markDirty(data, FcitxQtICData::Dirty_Capability);
         }
     }
 
@@ -173,16 +256,47 @@ private:
         auto newcaps = data.capability & (~capability);
         if (data.capability != newcaps || forceUpdate) {
             data.capability = newcaps;
-            updateCapability(data);
+            markDirty(data, FcitxQtICData::Dirty_Capability);
         }
     }
 
-    void updateCapability(const FcitxQtICData &data);
+    void setICFocus(FcitxQtICData &data, bool focus);
+    // Changes are sent together once the event loop is idle, or before the
+    // next key, whichever comes first.
+    void markDirty(FcitxQtICData &data, int fields);
+    void flushState(FcitxQtICData &data);
+    // Same as flushState, but returns the changes in the format of
+    // ProcessKeyEventWithState instead of sending them.
+    QVariantMap takeStateChanges(FcitxQtICData &data);
+    // Connect the watcher to the bus, which is only done once an input
+    // context is needed.
+    void connectBus();
     void createICData(QWindow *w);
+    void setupICData(FcitxQtICData &data);
+    void fillICPool();
+    // Forget the state of the window data was bound to.
+    void resetWindowState(FcitxQtICData &data);
+    // Create input context for window if the focus object accepts input
+    // method, or unconditionally if creation is not deferred.
+    void ensureICData(QWindow *window);
     FcitxQtInputContextProxy *validIC();
     FcitxQtInputContextProxy *validICByWindow(QWindow *window);
     bool filterEventFallback(unsigned int keyval, unsigned int keycode,
                              unsigned int state, bool isRelaese);
+    bool coalesceKeyRepeat(FcitxQtICData &data, const QKeyEvent &keyEvent);
+    // Returns false if data is destroyed while waiting.
+    bool waitForOldestKey(FcitxQtICData &data);
+    // Returns true if the key at index is finished within timeout. Posted
+    // events and timers are delivered while waiting, so data may be
+    // destroyed by the time it returns, but no key is handled.
+    bool waitForKeyReply(FcitxQtICData &data, size_t index,
+                         std::chrono::milliseconds timeout);
+    void processPendingKeys(FcitxQtICData &data);
+    void finishKeyEvent(FcitxQtICData &data,
+                        const KeyEventQueue::Entry &entry);
+    void recordKeyLatency(FcitxQtICData &data,
+                          std::chrono::steady_clock::time_point sentTime);
+    void reportKeyLatency();
 
     void updateCursorRect();
     bool objectAcceptsInputMethod() const;
@@ -195,11 +309,47 @@ private:
     int cursorPos_;
     bool useSurroundingText_;
     bool syncMode_;
+    // Wait up to this for a reply in filterEvent before falling back to the
+    // async path. Zero means always async.
+    std::chrono::milliseconds syncDeadline_;
+    // Wait up to this for the oldest key when too many keys are pending,
+    // before it's handled as if fcitx failed.
+    std::chrono::milliseconds keyReplyTimeout_;
+    // Set while waitForKeyReply waits.
+    bool waitingKeyReply_ = false;
+    KeyRepeatCoalesce repeatCoalesce_;
+    size_t maxPendingKeys_;
+    // Key latency is only tracked if it's reported periodically or on exit.
+    int keyLatencyInterval_;
+    bool keyLatencyReportOnExit_;
+    LatencyHistogram keyLatency_;
+    // If not null, key events are sent and their replies are received in
+    // this thread.
+    QThread *keyThread_ = nullptr;
+    // If true, input context of a window is only created once it's needed,
+    // see ensureICData. Off unless asked for, since the first key of a window
+    // may then miss fcitx.
+    bool deferInputContext_;
+    // If true, there is at most one input context, which follows the focus
+    // window.
+    bool sharedInputContext_;
     std::unordered_map<QWindow *, FcitxQtICData> icMap_;
+    // Input contexts created ahead of time without a window, all keyed by
+    // nullptr. Nodes are moved into icMap_ when a window needs one. Also
+    // holds the shared input context while it has no window.
+    std::unordered_multimap<QWindow *, FcitxQtICData> icPool_;
+    size_t icPoolSize_;
     QPointer<QWindow> lastWindow_;
     QPointer<QObject> lastObject_;
     bool destroy_;
-    QScopedPointer<struct xkb_context, XkbContextDeleter> xkbContext_;
+    // Compose table is only used by the fallback when fcitx does not take a
+    // key, so it's not compiled before an object accepting input method gets
+    // focus.
+    std::future<CompiledCompose> composeFuture_;
+    // Set on destruction, the compilation checks it between its steps.
+    std::atomic<bool> composeCancelled_{false};
+    bool composeReady_ = false;
+    std::unique_ptr<ComposeCache> composeCache_;
     QScopedPointer<struct xkb_compose_table, XkbComposeTableDeleter>
         xkbComposeTable_;
     QScopedPointer<struct xkb_compose_state, XkbComposeStateDeleter>
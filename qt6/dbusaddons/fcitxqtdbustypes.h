@@ -135,6 +135,22 @@ FCITX5_QT_BEGIN_DECLARE_DBUS_TYPE(FcitxQtAddonState);
 FCITX5_QT_DECLARE_FIELD(QString, uniqueName, setUniqueName);
 FCITX5_QT_DECLARE_FIELD(bool, enabled, setEnabled);
 FCITX5_QT_END_DECLARE_DBUS_TYPE(FcitxQtAddonState);
+
+// A range of keys that fcitx wants to receive. A key matches if the keysym is
+// within [first, last] and its modifier state masked by stateMask equals
+// state.
+FCITX5_QT_BEGIN_DECLARE_DBUS_TYPE(FcitxQtKeyFilterRule);
+FCITX5_QT_DECLARE_FIELD(quint32, first, setFirst);
+FCITX5_QT_DECLARE_FIELD(quint32, last, setLast);
+FCITX5_QT_DECLARE_FIELD(quint32, stateMask, setStateMask);
+FCITX5_QT_DECLARE_FIELD(quint32, state, setState);
+
+public:
+bool matches(quint32 keyval, quint32 keyState) const;
+FCITX5_QT_END_DECLARE_DBUS_TYPE(FcitxQtKeyFilterRule);
+
+FCITX5QT6DBUSADDONS_EXPORT bool keyFilterMatches(
+    const FcitxQtKeyFilterRuleList &rules, quint32 keyval, quint32 keyState);
 } // namespace fcitx
 
 Q_DECLARE_METATYPE(fcitx::FcitxQtFormattedPreedit)
@@ -170,4 +186,7 @@ Q_DECLARE_METATYPE(fcitx::FcitxQtAddonInfoV2List)
 Q_DECLARE_METATYPE(fcitx::FcitxQtAddonState)
 Q_DECLARE_METATYPE(fcitx::FcitxQtAddonStateList)
 
+Q_DECLARE_METATYPE(fcitx::FcitxQtKeyFilterRule)
+Q_DECLARE_METATYPE(fcitx::FcitxQtKeyFilterRuleList)
+
 #endif // _DBUSADDONS_FCITXQTDBUSTYPES_H_
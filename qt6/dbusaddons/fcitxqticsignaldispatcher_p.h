@@ -0,0 +1,51 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+#ifndef _DBUSADDONS_FCITXQTICSIGNALDISPATCHER_P_H_
+#define _DBUSADDONS_FCITXQTICSIGNALDISPATCHER_P_H_
+
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QHash>
+#include <QObject>
+
+namespace fcitx {
+
+class FcitxQtInputContextProxyPrivate;
+
+// Receives the signals of every input context of a service on a connection
+// with a single match rule, and hands each of them to the proxy of its object
+// path. Signals of paths without a proxy, e.g. of an input context that is
+// just destroyed, are dropped.
+class FcitxQtICSignalDispatcher : public QObject {
+    Q_OBJECT
+public:
+    // Returns the dispatcher of service on connection, a new one is created
+    // if there is none yet.
+    static FcitxQtICSignalDispatcher *get(const QDBusConnection &connection,
+                                          const QString &service);
+
+    void add(const QString &path, FcitxQtInputContextProxyPrivate *proxy);
+    // The dispatcher deletes itself once the last proxy is removed.
+    void remove(const QString &path, FcitxQtInputContextProxyPrivate *proxy);
+
+private Q_SLOTS:
+    void dispatch(const QDBusMessage &message);
+
+private:
+    FcitxQtICSignalDispatcher(const QDBusConnection &connection,
+                              const QString &service, const QString &key);
+    ~FcitxQtICSignalDispatcher();
+
+    QDBusConnection connection_;
+    const QString service_;
+    const QString key_;
+    QHash<QString, FcitxQtInputContextProxyPrivate *> proxies_;
+};
+
+} // namespace fcitx
+
+#endif // _DBUSADDONS_FCITXQTICSIGNALDISPATCHER_P_H_
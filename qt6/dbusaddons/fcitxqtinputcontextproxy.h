@@ -11,6 +11,7 @@
 
 #include "fcitxqtdbustypes.h"
 #include <QDBusConnection>
+#include <QDBusMessage>
 #include <QDBusPendingReply>
 #include <QDBusServiceWatcher>
 #include <QObject>
@@ -39,6 +40,10 @@ public Q_SLOTS:
                                             unsigned int keycode,
                                             unsigned int state, bool type,
                                             unsigned int time);
+    QDBusPendingReply<bool>
+    processKeyEventWithState(const QVariantMap &changes, unsigned int keyval,
+                             unsigned int keycode, unsigned int state,
+                             bool type, unsigned int time);
     QDBusPendingReply<> reset();
     QDBusPendingReply<> setSupportedCapability(qulonglong caps);
     QDBusPendingReply<> setCapability(qulonglong caps);
@@ -56,6 +61,62 @@ public Q_SLOTS:
     QDBusPendingReply<> invokeAction(unsigned int action, int cursor);
 
     bool supportInvokeAction() const;
+    bool supportKeyFilter() const;
+    bool supportProcessKeyEventWithState() const;
+
+    /**
+     * Whether fcitx wants to receive the key.
+     *
+     * It's false only if fcitx has published a key filter with
+     * UpdateKeyFilter and the key matches none of its rules. Such a key can
+     * be handled locally without a call to processKeyEvent.
+     */
+    bool wantsKey(unsigned int keyval, unsigned int state) const;
+
+    /**
+     * Send ProcessKeyEvent and deliver the reply to returnMethod of receiver,
+     * which takes a bool, or errorMethod, which takes a QDBusError.
+     *
+     * Unlike the slot version, this doesn't create any object to track the
+     * reply.
+     */
+    bool processKeyEvent(unsigned int keyval, unsigned int keycode,
+                         unsigned int state, bool type, unsigned int time,
+                         QObject *receiver, const char *returnMethod,
+                         const char *errorMethod);
+
+    /**
+     * Same as processKeyEvent, but also carries the changes of input context
+     * state that need to be applied before the key.
+     *
+     * Known keys of changes are focus (b), capability (t), cursorRect (ai),
+     * cursorRectScale (d), surroundingText (s), surroundingCursor (u) and
+     * surroundingAnchor (u). Only usable if
+     * supportProcessKeyEventWithState() is true.
+     */
+    bool processKeyEventWithState(const QVariantMap &changes,
+                                  unsigned int keyval, unsigned int keycode,
+                                  unsigned int state, bool type,
+                                  unsigned int time, QObject *receiver,
+                                  const char *returnMethod,
+                                  const char *errorMethod);
+
+    /**
+     * The method call of processKeyEvent and processKeyEventWithState.
+     *
+     * The message can be sent through connection() from any thread, unlike
+     * the proxy itself. Only usable if isValid() is true.
+     */
+    QDBusMessage processKeyEventMessage(unsigned int keyval,
+                                        unsigned int keycode,
+                                        unsigned int state, bool type,
+                                        unsigned int time) const;
+    QDBusMessage processKeyEventWithStateMessage(const QVariantMap &changes,
+                                                 unsigned int keyval,
+                                                 unsigned int keycode,
+                                                 unsigned int state, bool type,
+                                                 unsigned int time) const;
+    QDBusConnection connection() const;
 
 Q_SIGNALS:
     void commitString(const QString &str);
@@ -72,10 +133,27 @@ Q_SIGNALS:
                             const FcitxQtStringKeyValueList &candidates,
                             int candidateIndex, int layoutHint, bool hasPrev,
                             bool hasNext);
+    /**
+     * The UpdateClientSideUI signal as it arrives, with its lists not decoded
+     * yet.
+     *
+     * updateClientSideUI is only emitted when it has a receiver, so code that
+     * discards most updates should connect to this one instead.
+     */
+    void updateClientSideUIMessage(const QDBusMessage &message);
+    /**
+     * Only the highlighted candidate and the preedit cursor changed since
+     * the last client side UI update.
+     *
+     * Only sent if FcitxCapabilityFlag_ClientSideUIDelta is set.
+     */
+    void updateClientSideUIHighlight(int candidateIndex, int cursorpos);
     void inputContextCreated(const QByteArray &uuid);
     void notifyFocusOut();
 
 private:
+    void clientSideUIMessage(const QDBusMessage &message);
+
     FcitxQtInputContextProxyPrivate *const d_ptr;
     Q_DECLARE_PRIVATE(FcitxQtInputContextProxy);
 };
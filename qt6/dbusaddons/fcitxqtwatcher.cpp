@@ -6,14 +6,33 @@
  */
 
 #include "fcitxqtwatcher_p.h"
+#include "fcitxqtinputmethodproxy.h"
 #include <QDBusConnection>
-#include <QDBusConnectionInterface>
+#include <QDBusMessage>
 #include <QDBusServiceWatcher>
+#include <QRandomGenerator>
+#include <algorithm>
 
 namespace fcitx {
 
+namespace {
+
+// Delay before creating input contexts, doubled after every failure up to
+// the maximum. fcitx may come back at any time, so it is tried forever.
+constexpr int reconnectDelay = 100;
+constexpr int maxReconnectDelay = 10000;
+// When fcitx shows up, every application on the desktop wants a new input
+// context. Spread them over this time, fcitx is still starting up.
+constexpr int reconnectJitter = 500;
+
+} // namespace
+
 FcitxQtWatcher::FcitxQtWatcher(QObject *parent)
-    : QObject(parent), d_ptr(new FcitxQtWatcherPrivate(this)) {}
+    : QObject(parent), d_ptr(new FcitxQtWatcherPrivate(this)) {
+    Q_D(FcitxQtWatcher);
+    connect(&d->reconnectTimer_, &QTimer::timeout, this,
+            &FcitxQtWatcher::reconnectRequested);
+}
 
 FcitxQtWatcher::FcitxQtWatcher(const QDBusConnection &connection,
                                QObject *parent)
@@ -21,7 +40,13 @@ FcitxQtWatcher::FcitxQtWatcher(const QDBusConnection &connection,
     setConnection(connection);
 }
 
-FcitxQtWatcher::~FcitxQtWatcher() { delete d_ptr; }
+FcitxQtWatcher::~FcitxQtWatcher() {
+    Q_D(FcitxQtWatcher);
+    d->resetPeer();
+    d->resetOwnerQueries();
+    qDeleteAll(d->featureWatchers_);
+    delete d_ptr;
+}
 
 bool FcitxQtWatcher::availability() const {
     Q_D(const FcitxQtWatcher);
@@ -50,19 +75,55 @@ bool FcitxQtWatcher::watchPortal() const {
 
 QString FcitxQtWatcher::serviceName() const {
     Q_D(const FcitxQtWatcher);
-    if (d->mainPresent_) {
+    if (!d->mainOwner_.isEmpty()) {
         return FCITX_MAIN_SERVICE_NAME;
     }
-    if (d->portalPresent_) {
+    if (!d->portalOwner_.isEmpty()) {
         return FCITX_PORTAL_SERVICE_NAME;
     }
     return QString();
 }
 
+QString FcitxQtWatcher::serviceOwner() const {
+    Q_D(const FcitxQtWatcher);
+    if (!d->mainOwner_.isEmpty()) {
+        return d->mainOwner_;
+    }
+    return d->portalOwner_;
+}
+
+void FcitxQtWatcher::setPeerToPeer(bool peerToPeer) {
+    Q_D(FcitxQtWatcher);
+    d->peerToPeer_ = peerToPeer;
+}
+
+bool FcitxQtWatcher::peerToPeer() const {
+    Q_D(const FcitxQtWatcher);
+    return d->peerToPeer_;
+}
+
+bool FcitxQtWatcher::isPeerToPeerConnected() const {
+    Q_D(const FcitxQtWatcher);
+    return d->peerConnected_;
+}
+
+QDBusConnection FcitxQtWatcher::inputContextConnection() const {
+    Q_D(const FcitxQtWatcher);
+    if (d->peerConnected_) {
+        return QDBusConnection(d->peerConnectionName_);
+    }
+    return connection();
+}
+
 void FcitxQtWatcher::setAvailability(bool availability) {
     Q_D(FcitxQtWatcher);
     if (d->availability_ != availability) {
         d->availability_ = availability;
+        if (availability) {
+            // A new instance of fcitx, start over.
+            d->reconnectFailures_ = 0;
+            d->reconnectTimer_.stop();
+        }
         Q_EMIT availabilityChanged(d->availability_);
     }
 }
@@ -80,17 +141,13 @@ void FcitxQtWatcher::watch() {
         d->serviceWatcher_.addWatchedService(FCITX_PORTAL_SERVICE_NAME);
     }
 
-    if (connection().interface()->isServiceRegistered(
-            FCITX_MAIN_SERVICE_NAME)) {
-        d->mainPresent_ = true;
-    }
-    if (d->watchPortal_ && connection().interface()->isServiceRegistered(
-                               FCITX_PORTAL_SERVICE_NAME)) {
-        d->portalPresent_ = true;
+    // Don't block on the bus, availability is updated once the owners are
+    // known.
+    queryOwner(FCITX_MAIN_SERVICE_NAME);
+    if (d->watchPortal_) {
+        queryOwner(FCITX_PORTAL_SERVICE_NAME);
     }
 
-    updateAvailability();
-
     d->watched_ = true;
 }
 
@@ -101,8 +158,9 @@ void FcitxQtWatcher::unwatch() {
     }
     disconnect(&d->serviceWatcher_, &QDBusServiceWatcher::serviceOwnerChanged,
                this, &FcitxQtWatcher::imChanged);
-    d->mainPresent_ = false;
-    d->portalPresent_ = false;
+    d->resetOwnerQueries();
+    d->mainOwner_.clear();
+    d->portalOwner_.clear();
     d->watched_ = false;
     updateAvailability();
 }
@@ -112,28 +170,194 @@ bool FcitxQtWatcher::isWatching() const {
     return d->watched_;
 }
 
-void FcitxQtWatcher::imChanged(const QString &service, const QString &,
+void FcitxQtWatcher::imChanged(const QString &service,
+                               const QString &oldOwner,
                                const QString &newOwner) {
     Q_D(FcitxQtWatcher);
-    if (service == FCITX_MAIN_SERVICE_NAME) {
-        if (!newOwner.isEmpty()) {
-            d->mainPresent_ = true;
-        } else {
-            d->mainPresent_ = false;
-        }
-    } else if (service == FCITX_PORTAL_SERVICE_NAME) {
-        if (!newOwner.isEmpty()) {
-            d->portalPresent_ = true;
-        } else {
-            d->portalPresent_ = false;
-        }
+    // The peer to peer connection belongs to the old owner of the service
+    // its address came from, the other service doesn't affect it.
+    if (service == d->peerService_) {
+        d->resetPeer();
     }
+    if (!oldOwner.isEmpty()) {
+        d->resetFeatures(oldOwner);
+    }
+    // The reply of a pending owner query is older than this.
+    delete d->ownerQueries_.take(service);
+    if (!newOwner.isEmpty()) {
+        // fcitx is just started, spread the input contexts of all
+        // applications.
+        d->reconnectJitter_ = true;
+    }
+    d->setOwner(service, newOwner);
 
     updateAvailability();
 }
 
+void FcitxQtWatcher::queryOwner(const QString &service) {
+    Q_D(FcitxQtWatcher);
+    auto call = QDBusMessage::createMethodCall(
+        QStringLiteral("org.freedesktop.DBus"),
+        QStringLiteral("/org/freedesktop/DBus"),
+        QStringLiteral("org.freedesktop.DBus"),
+        QStringLiteral("GetNameOwner"));
+    call << service;
+    auto *watcher =
+        new QDBusPendingCallWatcher(connection().asyncCall(call), this);
+    delete d->ownerQueries_.take(service);
+    d->ownerQueries_.insert(service, watcher);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, service]() { ownerQueryFinished(service); });
+}
+
+void FcitxQtWatcher::ownerQueryFinished(const QString &service) {
+    Q_D(FcitxQtWatcher);
+    auto *watcher = d->ownerQueries_.take(service);
+    if (!watcher) {
+        return;
+    }
+    watcher->deleteLater();
+    QDBusPendingReply<QString> reply = *watcher;
+    // An error means there is no owner.
+    d->setOwner(service, reply.isError() ? QString() : reply.value());
+    updateAvailability();
+}
+
 void FcitxQtWatcher::updateAvailability() {
     Q_D(FcitxQtWatcher);
-    setAvailability(d->mainPresent_ || d->portalPresent_);
+    const bool present = !serviceOwner().isEmpty();
+    if (!present || !d->peerToPeer_) {
+        d->resetPeer();
+        setAvailability(present);
+        return;
+    }
+
+    // Only announce availability once we know which connection to use.
+    if (d->peerResolved_) {
+        setAvailability(true);
+        return;
+    }
+    setAvailability(false);
+    if (!d->peerAddressWatcher_) {
+        requestPeerAddress();
+    }
+}
+
+void FcitxQtWatcher::requestPeerAddress() {
+    Q_D(FcitxQtWatcher);
+    d->peerService_ = serviceName();
+    FcitxQtInputMethodProxy improxy(
+        d->peerService_, "/org/freedesktop/portal/inputmethod", connection());
+    d->peerAddressWatcher_ =
+        new QDBusPendingCallWatcher(improxy.GetPeerToPeerAddress(), this);
+    connect(d->peerAddressWatcher_, &QDBusPendingCallWatcher::finished, this,
+            &FcitxQtWatcher::peerAddressFinished);
+}
+
+void FcitxQtWatcher::peerAddressFinished() {
+    Q_D(FcitxQtWatcher);
+    QDBusPendingReply<QString> reply = *d->peerAddressWatcher_;
+    d->peerAddressWatcher_->deleteLater();
+    d->peerAddressWatcher_ = nullptr;
+
+    if (!reply.isError() && !reply.value().isEmpty()) {
+        auto peer = QDBusConnection::connectToPeer(reply.value(),
+                                                   d->peerConnectionName_);
+        if (peer.isConnected()) {
+            d->peerConnected_ = true;
+        } else {
+            QDBusConnection::disconnectFromPeer(d->peerConnectionName_);
+        }
+    }
+    // If there is no peer to peer connection, fall back to the bus.
+    d->peerResolved_ = true;
+    updateAvailability();
+}
+
+FcitxQtWatcher::Features
+FcitxQtWatcher::features(const QString &uniqueName) const {
+    Q_D(const FcitxQtWatcher);
+    return d->features_.value(uniqueName);
+}
+
+void FcitxQtWatcher::detectFeatures(const QString &uniqueName,
+                                    const QString &path) {
+    Q_D(FcitxQtWatcher);
+    if (d->features_.contains(uniqueName) ||
+        d->featureWatchers_.contains(uniqueName)) {
+        return;
+    }
+    auto call = QDBusMessage::createMethodCall(
+        uniqueName, path, QStringLiteral("org.freedesktop.DBus.Introspectable"),
+        QStringLiteral("Introspect"));
+    auto *watcher = new QDBusPendingCallWatcher(
+        inputContextConnection().asyncCall(call), this);
+    d->featureWatchers_.insert(uniqueName, watcher);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, uniqueName]() { featuresFinished(uniqueName); });
+}
+
+void FcitxQtWatcher::featuresFinished(const QString &uniqueName) {
+    Q_D(FcitxQtWatcher);
+    auto *watcher = d->featureWatchers_.take(uniqueName);
+    if (!watcher) {
+        return;
+    }
+    watcher->deleteLater();
+    QDBusPendingReply<QString> reply = *watcher;
+    if (reply.isError()) {
+        // Let the next input context try again.
+        return;
+    }
+
+    const auto xml = reply.value();
+    Features features;
+    if (xml.contains(QLatin1String("InvokeAction"))) {
+        features |= InvokeActionFeature;
+    }
+    if (xml.contains(QLatin1String("UpdateKeyFilter"))) {
+        features |= KeyFilterFeature;
+    }
+    if (xml.contains(QLatin1String("ProcessKeyEventWithState"))) {
+        features |= ProcessKeyEventWithStateFeature;
+    }
+    d->features_.insert(uniqueName, features);
+    Q_EMIT featuresDetected(uniqueName);
+}
+
+void FcitxQtWatcher::scheduleReconnect() {
+    Q_D(FcitxQtWatcher);
+    // Requests made in the meantime are served by the same batch.
+    if (d->reconnectTimer_.isActive()) {
+        return;
+    }
+    const int delay = std::min(
+        reconnectDelay << std::min(d->reconnectFailures_, 16),
+        maxReconnectDelay);
+    int jitter = 0;
+    if (d->reconnectJitter_) {
+        d->reconnectJitter_ = false;
+        jitter = reconnectJitter;
+    } else if (d->reconnectFailures_) {
+        // Applications that failed together would otherwise retry together.
+        jitter = delay / 2;
+    }
+    d->reconnectTimer_.start(
+        delay + (jitter ? QRandomGenerator::global()->bounded(jitter) : 0));
+}
+
+void FcitxQtWatcher::reconnectFinished(bool success) {
+    Q_D(FcitxQtWatcher);
+    if (success) {
+        d->reconnectFailures_ = 0;
+        return;
+    }
+    // Other failures of the same batch join the retry scheduled by the first
+    // one.
+    if (d->reconnectTimer_.isActive()) {
+        return;
+    }
+    d->reconnectFailures_++;
+    scheduleReconnect();
 }
 } // namespace fcitx
@@ -20,6 +20,18 @@ class FcitxQtWatcherPrivate;
 class FCITX5QT6DBUSADDONS_EXPORT FcitxQtWatcher : public QObject {
     Q_OBJECT
 public:
+    /**
+     * Optional parts of the input context interface, which depend on the
+     * version of fcitx.
+     */
+    enum Feature {
+        NoFeature = 0,
+        InvokeActionFeature = (1 << 0),
+        KeyFilterFeature = (1 << 1),
+        ProcessKeyEventWithStateFeature = (1 << 2),
+    };
+    Q_DECLARE_FLAGS(Features, Feature)
+
     explicit FcitxQtWatcher(QObject *parent = nullptr);
     explicit FcitxQtWatcher(const QDBusConnection &connection,
                             QObject *parent = nullptr);
@@ -35,8 +47,61 @@ public:
 
     QString serviceName() const;
 
+    /**
+     * Unique name of the owner of serviceName(), empty if there is none.
+     */
+    QString serviceOwner() const;
+
+    /**
+     * Ask fcitx for a peer to peer address and talk to it over a direct
+     * connection instead of the bus. Falls back to the bus if fcitx does not
+     * provide one. Must be set before watch().
+     */
+    void setPeerToPeer(bool peerToPeer);
+    bool peerToPeer() const;
+
+    /**
+     * Whether the peer to peer connection to fcitx is established.
+     */
+    bool isPeerToPeerConnected() const;
+
+    /**
+     * The connection that should be used for input context, which is the
+     * peer to peer connection if it is established, otherwise connection().
+     */
+    QDBusConnection inputContextConnection() const;
+
+    /**
+     * Features of the fcitx instance with the unique name, or of the peer to
+     * peer connection if the name is empty. Empty until they are detected.
+     */
+    Features features(const QString &uniqueName) const;
+
+    /**
+     * Detect features of the fcitx instance with the unique name, by
+     * introspecting the input context at path. Only done once per instance,
+     * featuresDetected is emitted when it's done.
+     */
+    void detectFeatures(const QString &uniqueName, const QString &path);
+
+    /**
+     * Ask for input contexts to be created after a delay. Requests of all
+     * input contexts of this watcher are served together by
+     * reconnectRequested. The delay is doubled after every failure, up to a
+     * limit, and spread randomly when fcitx shows up and for every retry.
+     */
+    void scheduleReconnect();
+
+    /**
+     * Report whether creating an input context succeeded. A failure
+     * schedules another try.
+     */
+    void reconnectFinished(bool success);
+
 Q_SIGNALS:
     void availabilityChanged(bool);
+    void featuresDetected(const QString &uniqueName);
+    void reconnectRequested();
 
 private Q_SLOTS:
     void imChanged(const QString &service, const QString &oldOwner,
@@ -45,10 +110,17 @@ private Q_SLOTS:
 private:
     void setAvailability(bool availability);
     void updateAvailability();
+    void requestPeerAddress();
+    void peerAddressFinished();
+    void featuresFinished(const QString &uniqueName);
+    void queryOwner(const QString &service);
+    void ownerQueryFinished(const QString &service);
 
     FcitxQtWatcherPrivate *const d_ptr;
     Q_DECLARE_PRIVATE(FcitxQtWatcher);
 };
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(FcitxQtWatcher::Features)
 } // namespace fcitx
 
 #endif // _DBUSADDONS_FCITXQTWATCHER_H_
@@ -0,0 +1 @@
+../../qt5/platforminputcontext/clientsideuiview.cpp
\ No newline at end of file
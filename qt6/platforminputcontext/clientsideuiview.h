@@ -0,0 +1 @@
+../../qt5/platforminputcontext/clientsideuiview.h
\ No newline at end of file
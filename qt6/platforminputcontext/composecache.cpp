@@ -0,0 +1 @@
+../../qt5/platforminputcontext/composecache.cpp
\ No newline at end of file
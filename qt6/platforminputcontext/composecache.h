@@ -0,0 +1 @@
+../../qt5/platforminputcontext/composecache.h
\ No newline at end of file
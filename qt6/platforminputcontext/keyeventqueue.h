@@ -0,0 +1 @@
+../../qt5/platforminputcontext/keyeventqueue.h
\ No newline at end of file
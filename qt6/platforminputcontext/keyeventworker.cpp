@@ -0,0 +1 @@
+../../qt5/platforminputcontext/keyeventworker.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../qt5/platforminputcontext/keyeventworker.h
\ No newline at end of file
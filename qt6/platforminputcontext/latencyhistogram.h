@@ -0,0 +1 @@
+../../qt5/platforminputcontext/latencyhistogram.h
\ No newline at end of file
@@ -0,0 +1,142 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+
+// Compares the cost of issuing the frequent input context calls through the
+// generated FcitxQtInputContextProxyImpl, which builds a message for every
+// call, and through FcitxQtInputContextProxy, which reuses one message per
+// method, against a mock fcitx on a private bus.
+
+#include "fcitxqtinputcontextproxy.h"
+#include "fcitxqtinputcontextproxyimpl.h"
+#include "fcitxqtwatcher.h"
+#include "mockfcitx.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusPendingCall>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+using namespace fcitx;
+
+namespace {
+
+// Batches of calls in flight, so that the queue of dbus does not grow without
+// bound.
+constexpr int batchSize = 500;
+
+struct Result {
+    // Time spent in issuing calls.
+    qint64 issue = 0;
+    // Time until all replies arrived.
+    qint64 total = 0;
+};
+
+Result run(int iterations,
+           const std::function<QDBusPendingCall(int)> &call) {
+    Result result;
+    QElapsedTimer issue;
+    QElapsedTimer total;
+    std::vector<QDBusPendingCall> pending;
+    pending.reserve(batchSize);
+    total.start();
+    for (int i = 0; i < iterations;) {
+        issue.start();
+        for (int j = 0; j < batchSize && i < iterations; j++, i++) {
+            pending.push_back(call(i));
+        }
+        result.issue += issue.nsecsElapsed();
+        // Replies come in order.
+        pending.back().waitForFinished();
+        if (pending.back().isError()) {
+            std::cerr << pending.back().error().message().toStdString()
+                      << std::endl;
+        }
+        pending.clear();
+    }
+    result.total = total.nsecsElapsed();
+    return result;
+}
+
+void report(const char *name, int iterations, const Result &generated,
+            const Result &typed) {
+    auto perCall = [iterations](qint64 ns) {
+        return static_cast<double>(ns) / iterations;
+    };
+    std::cout << name << ": issue " << perCall(generated.issue) << " -> "
+              << perCall(typed.issue) << " ns/call ("
+              << qRound(100.0 * typed.issue / generated.issue)
+              << "%), round trip " << perCall(generated.total) << " -> "
+              << perCall(typed.total) << " ns/call ("
+              << qRound(100.0 * typed.total / generated.total) << "%)"
+              << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Benchmark of building and sending input context calls.");
+    parser.addHelpOption();
+    QCommandLineOption iterationsOption(
+        "iterations", "Issue <n> calls of every method.", "n", "20000");
+    parser.addOption(iterationsOption);
+    parser.process(app);
+    const int iterations =
+        std::max(parser.value(iterationsOption).toInt(), 1);
+
+    TestDBusDaemon daemon;
+    if (!daemon.isValid()) {
+        std::cerr << "Failed to start dbus-daemon." << std::endl;
+        return 1;
+    }
+
+    auto bus = QDBusConnection::connectToBus(daemon.address(),
+                                             QStringLiteral("client"));
+    {
+        MockFcitxThread fcitx(daemon.address());
+        FcitxQtWatcher watcher(bus);
+        watcher.watch();
+        FcitxQtInputContextProxy proxy(&watcher, nullptr);
+        if (!waitFor([&proxy]() { return proxy.isValid(); })) {
+            std::cerr << "Input context is not created." << std::endl;
+            return 1;
+        }
+        // Same input context, through the generated proxy.
+        FcitxQtInputContextProxyImpl impl(
+            fcitx->uniqueName(), fcitx->inputContext(1).path, bus);
+
+        report("ProcessKeyEvent", iterations,
+               run(iterations,
+                   [&impl](int i) {
+                       return impl.ProcessKeyEvent(0x61, 38, 0, i % 2, i);
+                   }),
+               run(iterations, [&proxy](int i) {
+                   return proxy.processKeyEvent(0x61, 38, 0, i % 2, i);
+               }));
+        report("SetCursorRectV2", iterations,
+               run(iterations,
+                   [&impl](int i) {
+                       return impl.SetCursorRectV2(i, i, 1, 10, 1.0);
+                   }),
+               run(iterations, [&proxy](int i) {
+                   return proxy.setCursorRectV2(i, i, 1, 10, 1.0);
+               }));
+        report("FocusIn", iterations,
+               run(iterations, [&impl](int) { return impl.FocusIn(); }),
+               run(iterations, [&proxy](int) { return proxy.focusIn(); }));
+    }
+    QDBusConnection::disconnectFromBus(bus.name());
+
+    return 0;
+}
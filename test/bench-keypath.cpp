@@ -0,0 +1,332 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+
+// Replays a key stream through the fcitx5 platform input context on the
+// offscreen platform, against a mock fcitx on a private bus, and reports
+// throughput, latency, D-Bus traffic and heap allocations of the key path.
+
+#include "latencyhistogram.h"
+#include "mockfcitx.h"
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QGuiApplication>
+#include <QInputMethodEvent>
+#include <QInputMethodQueryEvent>
+#include <QKeyEvent>
+#include <QTemporaryDir>
+#include <QWindow>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <qpa/qplatforminputcontext.h>
+#include <qpa/qplatforminputcontextfactory_p.h>
+#include <vector>
+
+#ifdef __GLIBC__
+namespace {
+// Only the GUI thread is counted, QtDBus and mock fcitx have their own.
+thread_local bool countAllocations = false;
+size_t allocations = 0;
+// Those made inside QPlatformInputContext::filterEvent.
+size_t filterAllocations = 0;
+} // namespace
+
+// Qt's containers use malloc directly instead of operator new.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    if (countAllocations) {
+        ++allocations;
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    if (countAllocations) {
+        ++allocations;
+    }
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (countAllocations) {
+        ++allocations;
+    }
+    return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+using namespace fcitx;
+
+namespace {
+
+// The focus object of the benchmark, it notifies every key that reaches the
+// application, either forwarded back or committed by fcitx.
+class BenchWindow : public QWindow {
+public:
+    std::function<void()> delivered;
+
+protected:
+    bool event(QEvent *event) override {
+        switch (event->type()) {
+        case QEvent::InputMethodQuery: {
+            auto *query = static_cast<QInputMethodQueryEvent *>(event);
+            for (int i = 0; i < 32; i++) {
+                const auto q = static_cast<Qt::InputMethodQuery>(1u << i);
+                if (!(query->queries() & q)) {
+                    continue;
+                }
+                switch (q) {
+                case Qt::ImEnabled:
+                    query->setValue(q, true);
+                    break;
+                case Qt::ImHints:
+                    query->setValue(q, static_cast<int>(Qt::ImhNone));
+                    break;
+                case Qt::ImCursorRectangle:
+                    query->setValue(q, QRect(0, 0, 1, 10));
+                    break;
+                default:
+                    break;
+                }
+            }
+            query->accept();
+            return true;
+        }
+        case QEvent::KeyPress:
+        case QEvent::KeyRelease:
+            if (delivered) {
+                delivered();
+            }
+            return true;
+        case QEvent::InputMethod:
+            if (delivered &&
+                !static_cast<QInputMethodEvent *>(event)
+                     ->commitString()
+                     .isEmpty()) {
+                delivered();
+            }
+            return true;
+        default:
+            break;
+        }
+        return QWindow::event(event);
+    }
+};
+
+struct KeyStroke {
+    QEvent::Type type;
+    int key;
+    quint32 keysym;
+    QString text;
+};
+
+std::vector<KeyStroke> makeKeyStream(const QString &text, int repeat) {
+    std::vector<KeyStroke> keys;
+    const auto ucs4 = text.toUcs4();
+    for (int i = 0; i < repeat; i++) {
+        for (auto c : ucs4) {
+            if (c == '\n' || c == '\r') {
+                continue;
+            }
+            const quint32 keysym = c < 0x100 ? c : c + 0x1000000;
+            const int key = c < 0x80 ? QChar(c).toUpper().unicode() : 0;
+            const auto str = QString::fromUcs4(&c, 1);
+            keys.push_back({QEvent::KeyPress, key, keysym, str});
+            keys.push_back({QEvent::KeyRelease, key, keysym, str});
+        }
+    }
+    return keys;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    qunsetenv("QT_IM_MODULE");
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Benchmark of the key path of the fcitx5 input context.");
+    parser.addHelpOption();
+    QCommandLineOption textOption(
+        "text", "Type the content of <file> instead of a pangram.", "file");
+    QCommandLineOption repeatOption("repeat", "Type the text <n> times.", "n",
+                                    "100");
+    QCommandLineOption latencyOption(
+        "latency-us", "Time mock fcitx spends on every key.", "usec", "0");
+    QCommandLineOption intervalOption(
+        "interval-us", "Time between two key events, 0 to send them at once.",
+        "usec", "0");
+    QCommandLineOption commitOption(
+        "commit", "Let mock fcitx eat keys and commit text instead of "
+                  "forwarding them back.");
+    QCommandLineOption peerOption(
+        "peer-to-peer", "Let mock fcitx provide a peer to peer address.");
+    QCommandLineOption pluginOption(
+        "plugin", "Path of the platform input context plugin.", "file",
+        QStringLiteral(FCITX5_QT_PLUGIN_FILE));
+    QCommandLineOption maxAllocationsOption(
+        "max-allocations",
+        "Fail if filterEvent allocates more than <n> times per key.", "n");
+    parser.addOptions({textOption, repeatOption, latencyOption,
+                       intervalOption, commitOption, peerOption,
+                       pluginOption, maxAllocationsOption});
+    parser.process(app);
+
+    QString text = QStringLiteral(
+        "The quick brown fox jumps over the lazy dog. ");
+    if (parser.isSet(textOption)) {
+        QFile file(parser.value(textOption));
+        if (!file.open(QIODevice::ReadOnly)) {
+            std::cerr << "Failed to open " << file.fileName().toStdString()
+                      << std::endl;
+            return 1;
+        }
+        text = QString::fromUtf8(file.readAll());
+    }
+    const auto keys =
+        makeKeyStream(text, std::max(parser.value(repeatOption).toInt(), 1));
+    const qint64 interval =
+        std::max(parser.value(intervalOption).toLongLong(), 0ll) * 1000;
+
+    TestDBusDaemon daemon;
+    if (!daemon.isValid()) {
+        std::cerr << "Failed to start dbus-daemon." << std::endl;
+        return 1;
+    }
+    qputenv("DBUS_SESSION_BUS_ADDRESS", daemon.address().toUtf8());
+
+    MockFcitxOptions options;
+    options.peerToPeer = parser.isSet(peerOption);
+    options.keyLatency =
+        std::chrono::microseconds(parser.value(latencyOption).toLongLong());
+    if (parser.isSet(commitOption)) {
+        options.keyMode = MockFcitxOptions::KeyMode::Commit;
+    }
+    MockFcitxThread fcitx(daemon.address(), options);
+
+    // Plugins are looked up in the platforminputcontexts sub directory.
+    QTemporaryDir pluginDir;
+    QDir(pluginDir.path()).mkdir("platforminputcontexts");
+    const QFileInfo plugin(parser.value(pluginOption));
+    QFile::link(plugin.absoluteFilePath(),
+                pluginDir.filePath("platforminputcontexts/" +
+                                   plugin.fileName()));
+    QCoreApplication::addLibraryPath(pluginDir.path());
+    std::unique_ptr<QPlatformInputContext> context(
+        QPlatformInputContextFactory::create(QStringLiteral("fcitx5")));
+    if (!context) {
+        std::cerr << "Failed to load "
+                  << plugin.absoluteFilePath().toStdString() << std::endl;
+        return 1;
+    }
+
+    BenchWindow window;
+    window.resize(100, 100);
+    window.show();
+    window.requestActivate();
+    if (!waitFor([&window]() { return window.isActive(); })) {
+        std::cerr << "Window is not activated." << std::endl;
+        return 1;
+    }
+    context->setFocusObject(&window);
+    if (!waitFor([&fcitx]() { return fcitx->inputContexts() > 0; })) {
+        std::cerr << "Input context is not created." << std::endl;
+        return 1;
+    }
+    // Let the initial state of input context settle.
+    waitFor([]() { return false; }, 200);
+    fcitx->resetCounters();
+
+    LatencyHistogram latency;
+    QElapsedTimer clock;
+    std::deque<qint64> pending;
+    window.delivered = [&latency, &clock, &pending]() {
+        if (pending.empty()) {
+            return;
+        }
+        latency.record((clock.nsecsElapsed() - pending.front()) / 1000);
+        pending.pop_front();
+    };
+
+    const bool commit = options.keyMode == MockFcitxOptions::KeyMode::Commit;
+    // The latency histogram and the pending timestamps are counted along,
+    // the histogram has fixed buckets and the deque rarely grows.
+#ifdef __GLIBC__
+    countAllocations = true;
+#endif
+    clock.start();
+    for (size_t i = 0; i < keys.size(); i++) {
+        while (interval && clock.nsecsElapsed() < qint64(i) * interval) {
+            QCoreApplication::processEvents();
+        }
+        const auto &key = keys[i];
+        // Committed text only tells when a key press is done.
+        const bool measured = !commit || key.type == QEvent::KeyPress;
+        if (measured) {
+            pending.push_back(clock.nsecsElapsed());
+        }
+        QKeyEvent event(key.type, key.key, Qt::NoModifier, 0, key.keysym, 0,
+                        key.text);
+#ifdef __GLIBC__
+        const auto before = allocations;
+#endif
+        const bool filtered = context->filterEvent(&event);
+#ifdef __GLIBC__
+        filterAllocations += allocations - before;
+#endif
+        if (!filtered && measured) {
+            // Not taken by the input context, the key is done right away.
+            pending.pop_back();
+            latency.record(0);
+        }
+        QCoreApplication::processEvents();
+    }
+    if (!waitFor([&pending]() { return pending.empty(); }, 30000)) {
+        std::cerr << pending.size() << " keys are lost." << std::endl;
+    }
+    const auto elapsed = clock.nsecsElapsed();
+#ifdef __GLIBC__
+    countAllocations = false;
+#endif
+
+    const double count = keys.size();
+    std::cout << "keys: " << keys.size() << " in " << elapsed / 1000000
+              << "ms, " << qRound64(count * 1e9 / elapsed) << " keys/s"
+              << std::endl;
+    std::cout << "latency: " << latency.summary().toStdString() << std::endl;
+    std::cout << "dbus: " << fcitx->calls() / count << " calls/key, "
+              << fcitx->messages() / count << " messages/key" << std::endl;
+#ifdef __GLIBC__
+    std::cout << "allocations: " << allocations / count
+              << "/key in the GUI thread, " << filterAllocations / count
+              << "/key in filterEvent" << std::endl;
+    if (parser.isSet(maxAllocationsOption) &&
+        filterAllocations / count >
+            parser.value(maxAllocationsOption).toDouble()) {
+        std::cerr << "filterEvent allocates more than "
+                  << parser.value(maxAllocationsOption).toStdString()
+                  << " times per key." << std::endl;
+        context.reset();
+        return 1;
+    }
+#endif
+
+    context.reset();
+    return 0;
+}
@@ -0,0 +1,270 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+
+// Measures what the fcitx5 platform input context adds to the startup of a
+// minimal application on the offscreen platform: the time until the first
+// frame of a window, and until fcitx has an input context for it, along with
+// the peak RSS of the process and the file descriptors it opens. Optionally
+// also how long the first key takes, which may wait for the compose table.
+//
+// Only the first start of a process is cold, so compare builds by running
+// it a number of times with --plugin pointing to the plugin of each build.
+
+#include "latencyhistogram.h"
+#include "mockfcitx.h"
+#include <QCommandLineParser>
+#include <QDBusConnection>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QGuiApplication>
+#include <QInputMethodQueryEvent>
+#include <QKeyEvent>
+#include <QTemporaryDir>
+#include <QWindow>
+#include <iostream>
+#include <memory>
+#include <qpa/qplatforminputcontext.h>
+#include <qpa/qplatforminputcontextfactory_p.h>
+
+using namespace fcitx;
+
+namespace {
+
+class StartupWindow : public QWindow {
+public:
+    bool exposed = false;
+
+protected:
+    void exposeEvent(QExposeEvent *event) override {
+        if (isExposed()) {
+            exposed = true;
+        }
+        QWindow::exposeEvent(event);
+    }
+
+    bool event(QEvent *event) override {
+        if (event->type() == QEvent::InputMethodQuery) {
+            auto *query = static_cast<QInputMethodQueryEvent *>(event);
+            if (query->queries() & Qt::ImEnabled) {
+                query->setValue(Qt::ImEnabled, true);
+            }
+            query->accept();
+            return true;
+        }
+        return QWindow::event(event);
+    }
+};
+
+struct Startup {
+    // All in microseconds, from the creation of the input context.
+    qint64 context = 0;
+    qint64 firstFrame = 0;
+    // Negative if fcitx is not running or never got an input context.
+    qint64 inputContext = -1;
+    // Time spent in filterEvent for the first key, negative if not measured.
+    qint64 firstKey = -1;
+};
+
+// Peak resident set size in kB, 0 if unknown.
+qint64 peakResidentKb() {
+    QFile file(QStringLiteral("/proc/self/status"));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+    while (!file.atEnd()) {
+        const auto line = file.readLine();
+        if (line.startsWith("VmHWM:")) {
+            return line.mid(6).simplified().split(' ').value(0).toLongLong();
+        }
+    }
+    return 0;
+}
+
+// Number of open file descriptors, -1 if unknown.
+int openFds() {
+    QDir dir(QStringLiteral("/proc/self/fd"));
+    if (!dir.exists()) {
+        return -1;
+    }
+    // Minus the one of the listing itself.
+    return dir.entryList(QDir::Files | QDir::System).size() - 1;
+}
+
+Startup startOnce(MockFcitxThread *fcitx, bool focus, bool key) {
+    Startup result;
+    const int inputContexts = fcitx ? (*fcitx)->inputContexts() : 0;
+    QElapsedTimer clock;
+    clock.start();
+    std::unique_ptr<QPlatformInputContext> context(
+        QPlatformInputContextFactory::create(QStringLiteral("fcitx5")));
+    result.context = clock.nsecsElapsed() / 1000;
+    if (!context) {
+        return result;
+    }
+
+    StartupWindow window;
+    window.resize(100, 100);
+    window.show();
+    if (waitFor([&window]() { return window.exposed; })) {
+        result.firstFrame = clock.nsecsElapsed() / 1000;
+    }
+    if (!focus) {
+        context.reset();
+        return result;
+    }
+    context->setFocusObject(&window);
+    // Right away, so it's handled locally while the input context is
+    // created, like a key typed as soon as the window shows up.
+    if (key) {
+        window.requestActivate();
+        if (waitFor([&window]() { return window.isActive(); })) {
+            QKeyEvent event(QEvent::KeyPress, Qt::Key_A, Qt::NoModifier, 0,
+                            'a', 0, QStringLiteral("a"));
+            QElapsedTimer keyClock;
+            keyClock.start();
+            context->filterEvent(&event);
+            result.firstKey = keyClock.nsecsElapsed() / 1000;
+        }
+    }
+    if (fcitx && waitFor([fcitx, inputContexts]() {
+            return (*fcitx)->inputContexts() > inputContexts;
+        })) {
+        result.inputContext = clock.nsecsElapsed() / 1000;
+    }
+    context.reset();
+    // Let the input context go away on fcitx side.
+    waitFor([]() { return false; }, 50);
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    qunsetenv("QT_IM_MODULE");
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Benchmark of the startup cost of the fcitx5 input context.");
+    parser.addHelpOption();
+    QCommandLineOption iterationsOption(
+        "iterations", "Start the application <n> times.", "n", "20");
+    QCommandLineOption noFcitxOption(
+        "no-fcitx", "Measure without fcitx running on the bus.");
+    QCommandLineOption noFocusOption(
+        "no-focus", "Never focus the window, like an application that does "
+                    "not take text input.");
+    QCommandLineOption sessionBusOption(
+        "session-bus", "Connect to the session bus up front like a D-Bus "
+                       "application, and let fcitx reuse it.");
+    QCommandLineOption keyOption(
+        "key", "Type a key as soon as the window is focused, and measure how "
+               "long the input context takes for it.");
+    QCommandLineOption pluginOption(
+        "plugin", "Path of the platform input context plugin.", "file",
+        QStringLiteral(FCITX5_QT_PLUGIN_FILE));
+    parser.addOptions({iterationsOption, noFcitxOption, noFocusOption,
+                       sessionBusOption, keyOption, pluginOption});
+    parser.process(app);
+    const int iterations =
+        std::max(parser.value(iterationsOption).toInt(), 1);
+    const bool focus = !parser.isSet(noFocusOption);
+    const bool key = focus && parser.isSet(keyOption);
+
+    TestDBusDaemon daemon;
+    if (!daemon.isValid()) {
+        std::cerr << "Failed to start dbus-daemon." << std::endl;
+        return 1;
+    }
+    qputenv("DBUS_SESSION_BUS_ADDRESS", daemon.address().toUtf8());
+
+    std::unique_ptr<MockFcitxThread> fcitx;
+    if (!parser.isSet(noFcitxOption)) {
+        fcitx = std::make_unique<MockFcitxThread>(daemon.address());
+    }
+
+    // Plugins are looked up in the platforminputcontexts sub directory.
+    QTemporaryDir pluginDir;
+    QDir(pluginDir.path()).mkdir("platforminputcontexts");
+    const QFileInfo plugin(parser.value(pluginOption));
+    QFile::link(plugin.absoluteFilePath(),
+                pluginDir.filePath("platforminputcontexts/" +
+                                   plugin.fileName()));
+    QCoreApplication::addLibraryPath(pluginDir.path());
+
+    if (parser.isSet(sessionBusOption)) {
+        qputenv("FCITX_QT_USE_SESSION_BUS", "1");
+        if (!QDBusConnection::sessionBus().isConnected()) {
+            std::cerr << "Failed to connect to the session bus." << std::endl;
+            return 1;
+        }
+    }
+
+    // The first start also loads the plugin and connects to the bus, which
+    // later ones in the same process share.
+    const int fds = openFds();
+    const auto first = startOnce(fcitx.get(), focus, key);
+    if (!first.firstFrame) {
+        std::cerr << "Failed to load "
+                  << plugin.absoluteFilePath().toStdString() << std::endl;
+        return 1;
+    }
+    std::cout << "first start: context " << first.context << "us, frame "
+              << first.firstFrame << "us";
+    if (first.inputContext >= 0) {
+        std::cout << ", input context " << first.inputContext << "us";
+    }
+    if (first.firstKey >= 0) {
+        std::cout << ", first key " << first.firstKey << "us";
+    }
+    std::cout << ", peak rss " << peakResidentKb() << "kB";
+    if (fds >= 0) {
+        // The connection of fcitx outlives the input context.
+        std::cout << ", fds +" << openFds() - fds;
+    }
+    // Only opened once an input context is needed.
+    std::cout << ", private bus "
+              << (QDBusConnection(QStringLiteral("fcitx")).isConnected()
+                      ? "yes"
+                      : "no");
+    std::cout << std::endl;
+
+    LatencyHistogram context;
+    LatencyHistogram firstFrame;
+    LatencyHistogram inputContext;
+    LatencyHistogram firstKey;
+    for (int i = 1; i < iterations; i++) {
+        const auto result = startOnce(fcitx.get(), focus, key);
+        context.record(result.context);
+        firstFrame.record(result.firstFrame);
+        if (result.inputContext >= 0) {
+            inputContext.record(result.inputContext);
+        }
+        if (result.firstKey >= 0) {
+            firstKey.record(result.firstKey);
+        }
+    }
+    if (iterations > 1) {
+        std::cout << "context: " << context.summary().toStdString()
+                  << std::endl;
+        std::cout << "first frame: " << firstFrame.summary().toStdString()
+                  << std::endl;
+        if (fcitx && focus) {
+            std::cout << "input context: "
+                      << inputContext.summary().toStdString() << std::endl;
+        }
+        if (key) {
+            std::cout << "first key: " << firstKey.summary().toStdString()
+                      << std::endl;
+        }
+    }
+    return 0;
+}
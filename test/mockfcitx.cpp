@@ -0,0 +1,526 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "mockfcitx.h"
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QDBusArgument>
+#include <QDBusMetaType>
+#include <QDBusObjectPath>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutexLocker>
+#include <QRegularExpression>
+#include <QTimer>
+#include <QVariant>
+#include <cstring>
+
+namespace fcitx {
+
+namespace {
+
+constexpr char inputMethodInterface[] = "org.fcitx.Fcitx.InputMethod1";
+constexpr char inputContextInterface[] = "org.fcitx.Fcitx.InputContext1";
+constexpr char controllerInterface[] = "org.fcitx.Fcitx.Controller1";
+constexpr char inputContextPrefix[] = "/org/freedesktop/portal/inputcontext/";
+
+QString interfaceOfPath(const QString &path) {
+    if (path == QLatin1String("/org/freedesktop/portal/inputmethod") ||
+        path == QLatin1String("/inputmethod")) {
+        return QLatin1String(inputMethodInterface);
+    }
+    if (path.startsWith(QLatin1String(inputContextPrefix))) {
+        return QLatin1String(inputContextInterface);
+    }
+    if (path == QLatin1String("/controller")) {
+        return QLatin1String(controllerInterface);
+    }
+    return QString();
+}
+
+// Returns the interface element of the interface file, without hidden
+// members.
+QString loadInterface(const QString &name, const QStringList &hiddenMembers) {
+    QFile file(QStringLiteral(MOCK_FCITX_INTERFACE_DIR "/%1.xml").arg(name));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+    auto xml = QString::fromUtf8(file.readAll());
+    const auto begin = xml.indexOf(QLatin1String("<interface"));
+    const auto end = xml.lastIndexOf(QLatin1String("</interface>"));
+    if (begin < 0 || end < begin) {
+        return QString();
+    }
+    xml = xml.mid(begin, end + int(strlen("</interface>")) - begin);
+    for (const auto &member : hiddenMembers) {
+        xml.remove(QRegularExpression(
+            QStringLiteral("<(method|signal) name=\"%1\"(/>|>.*?</\\1>)")
+                .arg(QRegularExpression::escape(member)),
+            QRegularExpression::DotMatchesEverythingOption));
+    }
+    return xml;
+}
+
+} // namespace
+
+bool waitFor(const std::function<bool()> &condition, int timeout) {
+    QElapsedTimer timer;
+    timer.start();
+    while (!condition()) {
+        if (timer.elapsed() > timeout) {
+            return false;
+        }
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 10);
+    }
+    return true;
+}
+
+TestDBusDaemon::TestDBusDaemon() {
+    process_.start(QStringLiteral("dbus-daemon"),
+                   {QStringLiteral("--session"), QStringLiteral("--nofork"),
+                    QStringLiteral("--print-address")});
+    if (process_.waitForStarted() && process_.waitForReadyRead()) {
+        address_ = QString::fromUtf8(process_.readLine().trimmed());
+    }
+}
+
+TestDBusDaemon::~TestDBusDaemon() {
+    process_.terminate();
+    process_.waitForFinished();
+}
+
+MockFcitx::MockFcitx(const QString &address, const MockFcitxOptions &options)
+    : options_(options), keyLatency_(options.keyLatency) {
+    registerFcitxQtDBusTypes();
+    for (const char *interface :
+         {inputMethodInterface, inputContextInterface, controllerInterface}) {
+        introspection_[QLatin1String(interface)] =
+            loadInterface(QLatin1String(interface), options_.hiddenMembers);
+    }
+
+    bus_ = QDBusConnection::connectToBus(address, QStringLiteral("mock-fcitx"));
+    bus_.registerVirtualObject("/", this, QDBusConnection::SubPath);
+    if (options_.peerToPeer) {
+        server_ = new QDBusServer(QStringLiteral("unix:tmpdir=/tmp"), this);
+        QObject::connect(server_, &QDBusServer::newConnection, this,
+                         [this](const QDBusConnection &connection) {
+                             peers_ << connection.name();
+                             QDBusConnection(connection)
+                                 .registerVirtualObject(
+                                     "/", this, QDBusConnection::SubPath);
+                         });
+    }
+    bus_.registerService("org.fcitx.Fcitx5");
+}
+
+MockFcitx::~MockFcitx() {
+    bus_.unregisterService("org.fcitx.Fcitx5");
+    QDBusConnection::disconnectFromBus(bus_.name());
+    for (const auto &peer : peers_) {
+        QDBusConnection::disconnectFromPeer(peer);
+    }
+}
+
+QString MockFcitx::introspect(const QString &path) const {
+    return introspection_.value(interfaceOfPath(path));
+}
+
+bool MockFcitx::handleMessage(const QDBusMessage &message,
+                              const QDBusConnection &connection) {
+    if (message.type() != QDBusMessage::MethodCallMessage) {
+        return false;
+    }
+    const auto interface = interfaceOfPath(message.path());
+    if (interface.isEmpty() ||
+        (!message.interface().isEmpty() && message.interface() != interface)) {
+        // Leave Introspectable and friends to QtDBus.
+        return false;
+    }
+    const auto &member = message.member();
+    if (options_.hiddenMembers.contains(member)) {
+        return false;
+    }
+
+    calls_++;
+    messages_++;
+    {
+        QMutexLocker locker(&mutex_);
+        callCounts_[member]++;
+    }
+    if (drops_.value(member) > 0) {
+        drops_[member]--;
+        return true;
+    }
+    if (failures_.value(member) > 0) {
+        failures_[member]--;
+        send(connection,
+             message.createErrorReply(QDBusError::Failed,
+                                      QStringLiteral("Injected failure.")));
+        return true;
+    }
+
+    if (interface == QLatin1String(inputMethodInterface)) {
+        return handleInputMethod(message, connection);
+    }
+    if (interface == QLatin1String(inputContextInterface)) {
+        return handleInputContext(message, connection);
+    }
+    return handleController(message, connection);
+}
+
+bool MockFcitx::handleInputMethod(const QDBusMessage &message,
+                                  const QDBusConnection &connection) {
+    const auto &member = message.member();
+    const auto args = message.arguments();
+    if (member == "GetPeerToPeerAddress") {
+        if (!server_) {
+            return false;
+        }
+        reply(connection, message, {server_->address()});
+        return true;
+    }
+    if (member != "CreateInputContext" || args.size() != 1) {
+        return false;
+    }
+
+    MockInputContext ic;
+    ic.id = ++lastInputContext_;
+    ic.path = QLatin1String(inputContextPrefix) + QString::number(ic.id);
+    const auto list = qdbus_cast<FcitxQtStringKeyValueList>(args[0]);
+    for (const auto &item : list) {
+        if (item.key() == QLatin1String("program")) {
+            ic.program = item.value();
+        } else if (item.key() == QLatin1String("display")) {
+            ic.display = item.value();
+        }
+    }
+    {
+        QMutexLocker locker(&mutex_);
+        inputContexts_[ic.id] = ic;
+        inputContextConnections_[ic.id] = connection.name();
+    }
+    reply(connection, message,
+          {QVariant::fromValue(QDBusObjectPath(ic.path)),
+           QByteArray(16, static_cast<char>(ic.id))});
+    return true;
+}
+
+bool MockFcitx::handleInputContext(const QDBusMessage &message,
+                                   const QDBusConnection &connection) {
+    const auto &member = message.member();
+    const auto args = message.arguments();
+    const int id =
+        message.path().mid(int(strlen(inputContextPrefix))).toInt();
+
+    if (member == "ProcessKeyEvent") {
+        return processKeyEvent(message, connection, id, 0);
+    }
+    if (member == "ProcessKeyEventWithState") {
+        return processKeyEvent(message, connection, id, 1);
+    }
+
+    {
+        QMutexLocker locker(&mutex_);
+        auto iter = inputContexts_.find(id);
+        if (iter == inputContexts_.end()) {
+            send(connection, message.createErrorReply(
+                                 QDBusError::UnknownObject,
+                                 QStringLiteral("No such input context.")));
+            return true;
+        }
+        auto &ic = *iter;
+        if (member == "FocusIn") {
+            ic.focused = true;
+        } else if (member == "FocusOut") {
+            ic.focused = false;
+        } else if (member == "SetCapability" && args.size() == 1) {
+            ic.capability = args[0].toULongLong();
+        } else if (member == "SetSupportedCapability" && args.size() == 1) {
+            ic.supportedCapability = args[0].toULongLong();
+        } else if ((member == "SetCursorRect" && args.size() == 4) ||
+                   (member == "SetCursorRectV2" && args.size() == 5)) {
+            ic.cursorRect = QRect(args[0].toInt(), args[1].toInt(),
+                                  args[2].toInt(), args[3].toInt());
+            ic.cursorRectScale = args.size() == 5 ? args[4].toDouble() : 1.0;
+        } else if (member == "SetSurroundingText" && args.size() == 3) {
+            ic.surroundingText = args[0].toString();
+            ic.cursor = args[1].toUInt();
+            ic.anchor = args[2].toUInt();
+        } else if (member == "SetSurroundingTextPosition" &&
+                   args.size() == 2) {
+            ic.cursor = args[0].toUInt();
+            ic.anchor = args[1].toUInt();
+        } else if (member == "DestroyIC") {
+            inputContexts_.erase(iter);
+            inputContextConnections_.remove(id);
+        }
+    }
+    reply(connection, message);
+    return true;
+}
+
+bool MockFcitx::handleController(const QDBusMessage &message,
+                                 const QDBusConnection &connection) {
+    const auto &member = message.member();
+    const auto args = message.arguments();
+    if (member == "CurrentInputMethod") {
+        reply(connection, message, {currentIM_});
+    } else if (member == "SetCurrentIM" && args.size() == 1) {
+        currentIM_ = args[0].toString();
+        reply(connection, message);
+    } else if (member == "State") {
+        reply(connection, message, {state_});
+    } else if (member == "Activate") {
+        state_ = 2;
+        reply(connection, message);
+    } else if (member == "Toggle") {
+        state_ = state_ == 2 ? 1 : 2;
+        reply(connection, message);
+    } else if (member == "CurrentUI") {
+        reply(connection, message, {QStringLiteral("mock")});
+    } else if (member == "Exit" || member == "Restart" ||
+               member == "Configure" || member == "ReloadConfig") {
+        reply(connection, message);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool MockFcitx::processKeyEvent(const QDBusMessage &message,
+                                const QDBusConnection &connection, int ic,
+                                int offset) {
+    const auto args = message.arguments();
+    if (args.size() != offset + 5) {
+        return false;
+    }
+    keys_++;
+
+    MockKeyEvent event;
+    event.ic = ic;
+    event.peerToPeer = connection.name() != bus_.name();
+    event.keyval = args[offset].toUInt();
+    event.keycode = args[offset + 1].toUInt();
+    event.state = args[offset + 2].toUInt();
+    event.isRelease = args[offset + 3].toBool();
+    event.time = args[offset + 4].toUInt();
+    if (offset) {
+        event.changes = qdbus_cast<QVariantMap>(args[0]);
+        QMutexLocker locker(&mutex_);
+        auto iter = inputContexts_.find(ic);
+        if (iter != inputContexts_.end()) {
+            applyChanges(*iter, event.changes);
+        }
+    }
+
+    if (keyLatency_.count()) {
+        QThread::usleep(keyLatency_.count());
+    }
+
+    bool filtered = false;
+    if (keyHandler_) {
+        filtered = keyHandler_(*this, event);
+    } else if (options_.keyMode == MockFcitxOptions::KeyMode::Commit) {
+        char32_t unicode = 0;
+        if (event.keyval < 0x100) {
+            unicode = event.keyval;
+        } else if (event.keyval >= 0x1000000) {
+            unicode = event.keyval - 0x1000000;
+        }
+        if (!event.isRelease && unicode) {
+            commitString(ic, QString::fromUcs4(&unicode, 1));
+        }
+        filtered = true;
+    }
+    reply(connection, message, {filtered});
+    return true;
+}
+
+void MockFcitx::applyChanges(MockInputContext &ic, const QVariantMap &changes) {
+    for (auto iter = changes.begin(); iter != changes.end(); ++iter) {
+        const auto &key = iter.key();
+        const auto &value = iter.value();
+        if (key == QLatin1String("capability")) {
+            ic.capability = value.toULongLong();
+        } else if (key == QLatin1String("focus")) {
+            ic.focused = value.toBool();
+        } else if (key == QLatin1String("surroundingText")) {
+            ic.surroundingText = value.toString();
+        } else if (key == QLatin1String("surroundingCursor")) {
+            ic.cursor = value.toUInt();
+        } else if (key == QLatin1String("surroundingAnchor")) {
+            ic.anchor = value.toUInt();
+        } else if (key == QLatin1String("cursorRectScale")) {
+            ic.cursorRectScale = value.toDouble();
+        } else if (key == QLatin1String("cursorRect")) {
+            const auto rect = qdbus_cast<QList<int>>(value);
+            if (rect.size() == 4) {
+                ic.cursorRect = QRect(rect[0], rect[1], rect[2], rect[3]);
+            }
+        }
+    }
+}
+
+void MockFcitx::reply(const QDBusConnection &connection,
+                      const QDBusMessage &message, const QVariantList &args) {
+    auto response = message.createReply(args);
+    if (options_.replyDelay.count()) {
+        QTimer::singleShot(int(options_.replyDelay.count()), this,
+                           [this, connection, response]() {
+                               send(connection, response);
+                           });
+        return;
+    }
+    send(connection, response);
+}
+
+void MockFcitx::send(const QDBusConnection &connection,
+                     const QDBusMessage &message) {
+    messages_++;
+    connection.send(message);
+}
+
+void MockFcitx::setKeyHandler(KeyHandler handler) {
+    keyHandler_ = std::move(handler);
+}
+
+void MockFcitx::setKeyLatency(std::chrono::microseconds latency) {
+    keyLatency_ = latency;
+}
+
+void MockFcitx::dropReplies(const QString &member, int count) {
+    drops_[member] += count;
+}
+
+void MockFcitx::failCalls(const QString &member, int count) {
+    failures_[member] += count;
+}
+
+void MockFcitx::commitString(int ic, const QString &text) {
+    emitSignal(ic, QStringLiteral("CommitString"), {text});
+}
+
+void MockFcitx::updateFormattedPreedit(
+    int ic, const FcitxQtFormattedPreeditList &preedit, int cursor) {
+    emitSignal(ic, QStringLiteral("UpdateFormattedPreedit"),
+               {QVariant::fromValue(preedit), cursor});
+}
+
+void MockFcitx::updateClientSideUI(
+    int ic, const FcitxQtFormattedPreeditList &preedit, int cursor,
+    const FcitxQtFormattedPreeditList &auxUp,
+    const FcitxQtFormattedPreeditList &auxDown,
+    const FcitxQtStringKeyValueList &candidates, int candidateIndex,
+    int layoutHint, bool hasPrev, bool hasNext) {
+    emitSignal(ic, QStringLiteral("UpdateClientSideUI"),
+               {QVariant::fromValue(preedit), cursor,
+                QVariant::fromValue(auxUp), QVariant::fromValue(auxDown),
+                QVariant::fromValue(candidates), candidateIndex, layoutHint,
+                hasPrev, hasNext});
+}
+
+void MockFcitx::updateClientSideUIHighlight(int ic, int candidateIndex,
+                                            int cursor) {
+    emitSignal(ic, QStringLiteral("UpdateClientSideUIHighlight"),
+               {candidateIndex, cursor});
+}
+
+void MockFcitx::forwardKey(int ic, quint32 keyval, quint32 state,
+                           bool isRelease) {
+    emitSignal(ic, QStringLiteral("ForwardKey"), {keyval, state, isRelease});
+}
+
+void MockFcitx::updateKeyFilter(int ic, bool enabled,
+                                const FcitxQtKeyFilterRuleList &rules) {
+    emitSignal(ic, QStringLiteral("UpdateKeyFilter"),
+               {enabled, QVariant::fromValue(rules)});
+}
+
+void MockFcitx::emitSignal(int ic, const QString &name,
+                           const QVariantList &args) {
+    QString path;
+    QString connection;
+    {
+        QMutexLocker locker(&mutex_);
+        if (!inputContexts_.contains(ic)) {
+            return;
+        }
+        path = inputContexts_[ic].path;
+        connection = inputContextConnections_[ic];
+    }
+    auto message = QDBusMessage::createSignal(
+        path, QLatin1String(inputContextInterface), name);
+    message.setArguments(args);
+    send(QDBusConnection(connection), message);
+}
+
+QString MockFcitx::uniqueName() const { return bus_.baseService(); }
+
+MockInputContext MockFcitx::inputContext(int id) const {
+    QMutexLocker locker(&mutex_);
+    return inputContexts_.value(id);
+}
+
+int MockFcitx::callCount(const QString &member) const {
+    QMutexLocker locker(&mutex_);
+    return callCounts_.value(member);
+}
+
+void MockFcitx::resetCounters() {
+    calls_ = 0;
+    messages_ = 0;
+    keys_ = 0;
+    QMutexLocker locker(&mutex_);
+    callCounts_.clear();
+}
+
+MockFcitxThread::MockFcitxThread(const QString &address,
+                                 const MockFcitxOptions &options)
+    : address_(address), options_(options) {
+    thread_.start();
+    context_.moveToThread(&thread_);
+    start();
+}
+
+MockFcitxThread::~MockFcitxThread() {
+    stop();
+    thread_.quit();
+    thread_.wait();
+}
+
+void MockFcitxThread::run(const std::function<void(MockFcitx &)> &func) {
+    QMetaObject::invokeMethod(
+        &context_,
+        [this, &func]() {
+            if (fcitx_) {
+                func(*fcitx_);
+            }
+        },
+        Qt::BlockingQueuedConnection);
+}
+
+void MockFcitxThread::stop() {
+    QMetaObject::invokeMethod(
+        &context_,
+        [this]() {
+            delete fcitx_;
+            fcitx_ = nullptr;
+        },
+        Qt::BlockingQueuedConnection);
+}
+
+void MockFcitxThread::start() {
+    QMetaObject::invokeMethod(
+        &context_,
+        [this]() {
+            if (!fcitx_) {
+                fcitx_ = new MockFcitx(address_, options_);
+            }
+        },
+        Qt::BlockingQueuedConnection);
+}
+
+} // namespace fcitx
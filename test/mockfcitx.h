@@ -0,0 +1,231 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#ifndef _TEST_MOCKFCITX_H_
+#define _TEST_MOCKFCITX_H_
+
+#include "fcitxqtdbustypes.h"
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusServer>
+#include <QDBusVirtualObject>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QProcess>
+#include <QRect>
+#include <QThread>
+#include <QVariantMap>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+namespace fcitx {
+
+// Processes events until condition returns true, returns false on timeout.
+bool waitFor(const std::function<bool()> &condition, int timeout = 5000);
+
+// A private dbus-daemon that lives as long as the object.
+class TestDBusDaemon {
+public:
+    TestDBusDaemon();
+    ~TestDBusDaemon();
+
+    bool isValid() const { return !address_.isEmpty(); }
+    const QString &address() const { return address_; }
+
+private:
+    QProcess process_;
+    QString address_;
+};
+
+struct MockFcitxOptions {
+    // What to do with a key when there is no key handler.
+    enum class KeyMode {
+        // Reply false to every key, so the client forwards it.
+        Forward,
+        // Eat every key, and commit the text of key press.
+        Commit,
+    };
+
+    // Also serve input contexts over a peer to peer connection.
+    bool peerToPeer = false;
+    // Time spent on every key before the reply, nothing else is served in
+    // the mean time.
+    std::chrono::microseconds keyLatency{0};
+    // Delay of every method reply, other calls are still served in the mean
+    // time.
+    std::chrono::milliseconds replyDelay{0};
+    KeyMode keyMode = KeyMode::Forward;
+    // Methods and signals that are left out from introspection, methods are
+    // also answered with UnknownMethod, like an older fcitx.
+    QStringList hiddenMembers;
+};
+
+// The state of an input context as the client has set it.
+struct MockInputContext {
+    int id = 0;
+    QString path;
+    QString program;
+    QString display;
+    bool focused = false;
+    quint64 capability = 0;
+    quint64 supportedCapability = 0;
+    QRect cursorRect;
+    double cursorRectScale = 1.0;
+    QString surroundingText;
+    quint32 cursor = 0;
+    quint32 anchor = 0;
+};
+
+struct MockKeyEvent {
+    int ic = 0;
+    quint32 keyval = 0;
+    quint32 keycode = 0;
+    quint32 state = 0;
+    bool isRelease = false;
+    quint32 time = 0;
+    // Only set for ProcessKeyEventWithState.
+    QVariantMap changes;
+    // Whether the key is received from a peer to peer connection.
+    bool peerToPeer = false;
+};
+
+// Stand-in of fcitx on a bus. It implements InputMethod1, InputContext1 and
+// a minimal Controller1, with the introspection data of the interface files
+// of this repository. Must be created and scripted in the thread that serves
+// it, see MockFcitxThread. Getters of recorded state are thread safe.
+class MockFcitx : public QDBusVirtualObject {
+public:
+    // Returns whether the key is filtered. Called in the thread of the mock,
+    // signals may be emitted from it, before the reply is sent.
+    using KeyHandler =
+        std::function<bool(MockFcitx &fcitx, const MockKeyEvent &event)>;
+
+    MockFcitx(const QString &address, const MockFcitxOptions &options);
+    ~MockFcitx();
+
+    QString introspect(const QString &path) const override;
+    bool handleMessage(const QDBusMessage &message,
+                       const QDBusConnection &connection) override;
+
+    // Scripting.
+    void setKeyHandler(KeyHandler handler);
+    // Replaces MockFcitxOptions::keyLatency.
+    void setKeyLatency(std::chrono::microseconds latency);
+    // Never reply to the next count calls of member.
+    void dropReplies(const QString &member, int count = 1);
+    // Reply an error to the next count calls of member.
+    void failCalls(const QString &member, int count = 1);
+
+    // Signals of InputContext1.
+    void commitString(int ic, const QString &text);
+    void updateFormattedPreedit(int ic,
+                                const FcitxQtFormattedPreeditList &preedit,
+                                int cursor);
+    void updateClientSideUI(int ic, const FcitxQtFormattedPreeditList &preedit,
+                            int cursor,
+                            const FcitxQtFormattedPreeditList &auxUp,
+                            const FcitxQtFormattedPreeditList &auxDown,
+                            const FcitxQtStringKeyValueList &candidates,
+                            int candidateIndex, int layoutHint, bool hasPrev,
+                            bool hasNext);
+    void updateClientSideUIHighlight(int ic, int candidateIndex, int cursor);
+    void forwardKey(int ic, quint32 keyval, quint32 state, bool isRelease);
+    void updateKeyFilter(int ic, bool enabled,
+                         const FcitxQtKeyFilterRuleList &rules);
+    void emitSignal(int ic, const QString &name, const QVariantList &args);
+
+    // Unique name on the bus.
+    QString uniqueName() const;
+    // Number of input contexts ever created, the last one has the largest
+    // id.
+    int inputContexts() const { return lastInputContext_; }
+    // Returns a default constructed one if the id is not alive.
+    MockInputContext inputContext(int id) const;
+    int callCount(const QString &member) const;
+    // Method calls received.
+    quint64 calls() const { return calls_; }
+    // Method calls received, plus replies and signals sent.
+    quint64 messages() const { return messages_; }
+    quint64 keys() const { return keys_; }
+    void resetCounters();
+
+private:
+    bool handleInputMethod(const QDBusMessage &message,
+                           const QDBusConnection &connection);
+    bool handleInputContext(const QDBusMessage &message,
+                            const QDBusConnection &connection);
+    bool handleController(const QDBusMessage &message,
+                          const QDBusConnection &connection);
+    bool processKeyEvent(const QDBusMessage &message,
+                         const QDBusConnection &connection, int ic,
+                         int offset);
+    void applyChanges(MockInputContext &ic, const QVariantMap &changes);
+    void reply(const QDBusConnection &connection, const QDBusMessage &message,
+               const QVariantList &args = {});
+    void send(const QDBusConnection &connection, const QDBusMessage &message);
+
+    const MockFcitxOptions options_;
+    // Interface name to introspection data.
+    QHash<QString, QString> introspection_;
+    QDBusConnection bus_{QString()};
+    QDBusServer *server_ = nullptr;
+    QStringList peers_;
+    KeyHandler keyHandler_;
+    std::chrono::microseconds keyLatency_;
+    QHash<QString, int> drops_;
+    QHash<QString, int> failures_;
+    QString currentIM_ = QStringLiteral("keyboard-us");
+    int state_ = 1;
+
+    mutable QMutex mutex_;
+    // Guarded by mutex_.
+    QMap<int, MockInputContext> inputContexts_;
+    QMap<int, QString> inputContextConnections_;
+    QHash<QString, int> callCounts_;
+
+    std::atomic<int> lastInputContext_{0};
+    std::atomic<quint64> calls_{0};
+    std::atomic<quint64> messages_{0};
+    std::atomic<quint64> keys_{0};
+};
+
+// Runs a MockFcitx in its own thread, so it can answer blocking calls made
+// by the client.
+class MockFcitxThread {
+public:
+    MockFcitxThread(const QString &address,
+                    const MockFcitxOptions &options = {});
+    ~MockFcitxThread();
+
+    // Only the thread safe getters may be used directly.
+    MockFcitx *operator->() { return fcitx_; }
+
+    // Run func in the thread of the mock and wait for it.
+    void run(const std::function<void(MockFcitx &)> &func);
+
+    // Simulate fcitx going away from the bus and coming back. All state of
+    // the mock, including scripting, is lost like in a real restart.
+    void stop();
+    void start();
+    void restart() {
+        stop();
+        start();
+    }
+    bool isRunning() const { return fcitx_; }
+
+private:
+    const QString address_;
+    const MockFcitxOptions options_;
+    QThread thread_;
+    QObject context_;
+    MockFcitx *fcitx_ = nullptr;
+};
+
+} // namespace fcitx
+
+#endif // _TEST_MOCKFCITX_H_
@@ -0,0 +1,153 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "composecache.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+#include <cstring>
+#include <fcitx-utils/log.h>
+
+using namespace fcitx;
+
+namespace {
+
+const char composeRules[] =
+    "<Multi_key> <a> <e> : \"æ\" ae\n"
+    "<Multi_key> <o> <c> : \"©\" copyright\n"
+    "<dead_acute> <e> : \"é\" eacute\n"
+    "<dead_acute> <E> : Eacute\n";
+
+QByteArray key(const char *name) {
+    return QCryptographicHash::hash(name, QCryptographicHash::Sha1);
+}
+
+void testFeed(ComposeCache &cache) {
+    FCITX_ASSERT(cache.feed(XKB_KEY_a) == ComposeCache::Status::Nothing);
+    FCITX_ASSERT(cache.feed(XKB_KEY_Multi_key) ==
+                 ComposeCache::Status::Composing);
+    // Modifiers don't break a sequence.
+    FCITX_ASSERT(cache.feed(XKB_KEY_Shift_L) == ComposeCache::Status::Ignored);
+    FCITX_ASSERT(cache.feed(XKB_KEY_a) == ComposeCache::Status::Composing);
+    FCITX_ASSERT(cache.feed(XKB_KEY_e) == ComposeCache::Status::Composed);
+    FCITX_ASSERT(cache.text() == QStringLiteral("æ")) << cache.text();
+
+    FCITX_ASSERT(cache.feed(XKB_KEY_Multi_key) ==
+                 ComposeCache::Status::Composing);
+    FCITX_ASSERT(cache.feed(XKB_KEY_x) == ComposeCache::Status::Cancelled);
+    // Cancelled starts over.
+    FCITX_ASSERT(cache.feed(XKB_KEY_dead_acute) ==
+                 ComposeCache::Status::Composing);
+    FCITX_ASSERT(cache.feed(XKB_KEY_e) == ComposeCache::Status::Composed);
+    FCITX_ASSERT(cache.text() == QStringLiteral("é"));
+
+    // Only a keysym in the rule, the text comes from it.
+    FCITX_ASSERT(cache.feed(XKB_KEY_dead_acute) ==
+                 ComposeCache::Status::Composing);
+    FCITX_ASSERT(cache.feed(XKB_KEY_E) == ComposeCache::Status::Composed);
+    FCITX_ASSERT(cache.text() == QStringLiteral("É"));
+
+    FCITX_ASSERT(cache.feed(XKB_KEY_Multi_key) ==
+                 ComposeCache::Status::Composing);
+    cache.reset();
+    FCITX_ASSERT(cache.feed(XKB_KEY_o) == ComposeCache::Status::Nothing);
+}
+
+void writeFile(const QString &path, const QByteArray &content) {
+    QFile file(path);
+    FCITX_ASSERT(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    file.write(content);
+}
+
+// The cache of a locale is dropped when any file the table comes from
+// changes, found through the aliases of the locale and the includes of the
+// user Compose file.
+void testLocaleFiles(struct xkb_compose_table *table) {
+    QTemporaryDir dir;
+    const QString localeDir = dir.filePath(QStringLiteral("locale"));
+    const QString home = dir.filePath(QStringLiteral("home"));
+    FCITX_ASSERT(QDir().mkpath(localeDir + QStringLiteral("/en_US.UTF-8")));
+    FCITX_ASSERT(QDir().mkpath(home));
+    qputenv("XLOCALEDIR", QFile::encodeName(localeDir));
+    qputenv("HOME", QFile::encodeName(home));
+    qputenv("XDG_CACHE_HOME", QFile::encodeName(dir.filePath(QStringLiteral("cache"))));
+    qunsetenv("XCOMPOSEFILE");
+    qunsetenv("XDG_CONFIG_HOME");
+    writeFile(localeDir + QStringLiteral("/locale.alias"),
+              "en_US.utf8:\ten_US.UTF-8\n");
+    writeFile(localeDir + QStringLiteral("/compose.dir"),
+              "en_US.UTF-8/Compose:\t\ten_US.UTF-8\n");
+    const QString localeFile =
+        localeDir + QStringLiteral("/en_US.UTF-8/Compose");
+    writeFile(localeFile, composeRules);
+    writeFile(home + QStringLiteral("/.XCompose"),
+              "include \"%L\"\n<Multi_key> <x> <x> : \"×\"\n");
+
+    const QString locale = QStringLiteral("en_US.utf8");
+    FCITX_ASSERT(ComposeCache::build(locale, table));
+    FCITX_ASSERT(ComposeCache::open(locale));
+    // Only reached through the alias and the include.
+    writeFile(localeFile, QByteArray(composeRules) + "# changed\n");
+    FCITX_ASSERT(!ComposeCache::open(locale));
+
+    // Not known, so never cached.
+    writeFile(home + QStringLiteral("/.XCompose"), "include \"%Q\"\n");
+    FCITX_ASSERT(!ComposeCache::build(locale, table));
+    FCITX_ASSERT(!ComposeCache::open(locale));
+}
+
+} // namespace
+
+int main() {
+    struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    FCITX_ASSERT(context);
+    struct xkb_compose_table *table = xkb_compose_table_new_from_buffer(
+        context, composeRules, strlen(composeRules), "C",
+        XKB_COMPOSE_FORMAT_TEXT_V1, XKB_COMPOSE_COMPILE_NO_FLAGS);
+    FCITX_ASSERT(table);
+
+    QTemporaryDir dir;
+    const QString path = dir.filePath(QStringLiteral("compose.cache"));
+    const bool written = ComposeCache::write(path, key("C"), table);
+#ifndef FCITX_QT_HAS_COMPOSE_ITERATOR
+    // xkbcommon can't enumerate the table.
+    FCITX_ASSERT(!written);
+    xkb_compose_table_unref(table);
+    xkb_context_unref(context);
+    return 0;
+#endif
+    FCITX_ASSERT(written);
+    testLocaleFiles(table);
+    xkb_compose_table_unref(table);
+    xkb_context_unref(context);
+
+    auto cache = ComposeCache::map(path, key("C"));
+    FCITX_ASSERT(cache);
+    testFeed(*cache);
+
+    // Built from something else.
+    FCITX_ASSERT(!ComposeCache::map(path, key("en_US.UTF-8")));
+    FCITX_ASSERT(!ComposeCache::map(dir.filePath(QStringLiteral("missing")),
+                                    key("C")));
+
+    // A truncated file is never mapped.
+    QFile file(path);
+    FCITX_ASSERT(file.open(QIODevice::ReadOnly));
+    const QByteArray data = file.readAll();
+    const QString truncated = dir.filePath(QStringLiteral("truncated.cache"));
+    QFile truncatedFile(truncated);
+    FCITX_ASSERT(truncatedFile.open(QIODevice::WriteOnly));
+    truncatedFile.write(data.left(data.size() - 1));
+    truncatedFile.close();
+    FCITX_ASSERT(!ComposeCache::map(truncated, key("C")));
+
+    // Still usable after the file is removed.
+    FCITX_ASSERT(QFile::remove(path));
+    testFeed(*cache);
+
+    return 0;
+}
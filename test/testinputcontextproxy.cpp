@@ -0,0 +1,349 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "clientsideuiview.h"
+#include "fcitxqtinputcontextproxy.h"
+#include "fcitxqtwatcher.h"
+#include "mockfcitx.h"
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <fcitx-utils/keysym.h>
+#include <fcitx-utils/log.h>
+#include <utility>
+
+using namespace fcitx;
+
+namespace {
+
+FcitxQtFormattedPreeditList makePreedit(const QString &text) {
+    FcitxQtFormattedPreedit preedit;
+    preedit.setString(text);
+    preedit.setFormat(0);
+    return {preedit};
+}
+
+void testSignals(MockFcitxThread &fcitx, FcitxQtInputContextProxy &proxy) {
+    const int ic = fcitx->inputContexts();
+    QString commit;
+    FcitxQtFormattedPreeditList preedit;
+    FcitxQtStringKeyValueList candidates;
+    QList<QMetaObject::Connection> connections;
+    connections << QObject::connect(
+        &proxy, &FcitxQtInputContextProxy::commitString,
+        [&commit](const QString &str) { commit = str; });
+    connections << QObject::connect(
+        &proxy, &FcitxQtInputContextProxy::updateFormattedPreedit,
+        [&preedit](const FcitxQtFormattedPreeditList &str, int) {
+            preedit = str;
+        });
+    connections << QObject::connect(
+        &proxy, &FcitxQtInputContextProxy::updateClientSideUI,
+        [&candidates](const FcitxQtFormattedPreeditList &, int,
+                      const FcitxQtFormattedPreeditList &,
+                      const FcitxQtFormattedPreeditList &,
+                      const FcitxQtStringKeyValueList &list, int, int, bool,
+                      bool) { candidates = list; });
+
+    fcitx.run([ic](MockFcitx &mock) {
+        FcitxQtStringKeyValue candidate;
+        candidate.setKey(QStringLiteral("1."));
+        candidate.setValue(QStringLiteral("candidate"));
+        mock.updateFormattedPreedit(ic, makePreedit(QStringLiteral("pre")), 3);
+        mock.updateClientSideUI(ic, {}, 0, {}, {}, {candidate}, 0, 0, false,
+                                true);
+        mock.commitString(ic, QStringLiteral("commit"));
+    });
+    FCITX_ASSERT(waitFor([&commit]() { return !commit.isEmpty(); }));
+    // Signals arrive in order.
+    FCITX_ASSERT(preedit == makePreedit(QStringLiteral("pre")));
+    FCITX_ASSERT(candidates.size() == 1);
+    FCITX_ASSERT(candidates[0].value() == QLatin1String("candidate"));
+    FCITX_ASSERT(commit == QLatin1String("commit"));
+    for (const auto &connection : connections) {
+        QObject::disconnect(connection);
+    }
+}
+
+void testClientSideUI(MockFcitxThread &fcitx,
+                      FcitxQtInputContextProxy &proxy) {
+    const int ic = fcitx->inputContexts();
+    QList<QDBusMessage> messages;
+    auto connection = QObject::connect(
+        &proxy, &FcitxQtInputContextProxy::updateClientSideUIMessage,
+        [&messages](const QDBusMessage &message) { messages << message; });
+
+    fcitx.run([ic](MockFcitx &mock) {
+        FcitxQtStringKeyValue candidate;
+        candidate.setKey(QStringLiteral("1."));
+        candidate.setValue(QStringLiteral("candidate"));
+        const auto preedit = makePreedit(QStringLiteral("pre"));
+        mock.updateClientSideUI(ic, preedit, 3, {}, {}, {candidate}, 0, 1,
+                                false, true);
+        // Only the highlight moves.
+        mock.updateClientSideUI(ic, preedit, 3, {}, {}, {candidate}, -1, 1,
+                                false, true);
+        candidate.setValue(QStringLiteral("other"));
+        mock.updateClientSideUI(ic, preedit, 3, {}, {}, {candidate}, 0, 1,
+                                false, true);
+    });
+    FCITX_ASSERT(waitFor([&messages]() { return messages.size() == 3; }));
+    QObject::disconnect(connection);
+
+    using Section = ClientSideUIView::Section;
+    ClientSideUIView views[] = {ClientSideUIView(messages[0]),
+                                ClientSideUIView(messages[1]),
+                                ClientSideUIView(messages[2])};
+    auto &view = views[0];
+    FCITX_ASSERT(view.isValid());
+    FCITX_ASSERT(view.preedit() == makePreedit(QStringLiteral("pre")));
+    FCITX_ASSERT(view.cursor() == 3);
+    FCITX_ASSERT(view.auxUp().isEmpty() && view.auxDown().isEmpty());
+    FCITX_ASSERT(view.candidates().size() == 1);
+    FCITX_ASSERT(view.candidates()[0].value() == QLatin1String("candidate"));
+    FCITX_ASSERT(view.candidateIndex() == 0);
+    FCITX_ASSERT(view.layoutHint() == 1);
+    FCITX_ASSERT(!view.hasPrev() && view.hasNext());
+    // A list is decoded once.
+    const auto *candidates = &view.candidates();
+    FCITX_ASSERT(&view.candidates() == candidates);
+
+    FCITX_ASSERT(views[1].candidateIndex() == -1);
+    for (auto section : {Section::Preedit, Section::AuxUp, Section::AuxDown,
+                         Section::Candidates}) {
+        FCITX_ASSERT(views[0].fingerprint(section) ==
+                     views[1].fingerprint(section));
+    }
+    FCITX_ASSERT(views[1].fingerprint(Section::Preedit) ==
+                 views[2].fingerprint(Section::Preedit));
+    FCITX_ASSERT(views[1].fingerprint(Section::Candidates) !=
+                 views[2].fingerprint(Section::Candidates));
+    FCITX_ASSERT(views[2].candidates()[0].value() == QLatin1String("other"));
+    FCITX_ASSERT(views[0].fingerprint(Section::AuxUp) !=
+                 views[0].fingerprint(Section::Preedit));
+
+    std::pair<int, int> highlight{-1, -1};
+    connection = QObject::connect(
+        &proxy, &FcitxQtInputContextProxy::updateClientSideUIHighlight,
+        [&highlight](int candidateIndex, int cursor) {
+            highlight = {candidateIndex, cursor};
+        });
+    fcitx.run([ic](MockFcitx &mock) {
+        mock.updateClientSideUIHighlight(ic, 2, 1);
+    });
+    FCITX_ASSERT(waitFor([&highlight]() { return highlight.first == 2; }));
+    FCITX_ASSERT(highlight.second == 1);
+    QObject::disconnect(connection);
+}
+
+void testState(MockFcitxThread &fcitx, FcitxQtInputContextProxy &proxy) {
+    const int ic = fcitx->inputContexts();
+    proxy.setCapability(0x12);
+    proxy.setSurroundingText(QStringLiteral("abc"), 1, 2);
+    auto reply = proxy.focusIn();
+    reply.waitForFinished();
+    const auto state = fcitx->inputContext(ic);
+    FCITX_ASSERT(state.focused);
+    FCITX_ASSERT(state.capability == 0x12);
+    FCITX_ASSERT(state.surroundingText == QLatin1String("abc"));
+    FCITX_ASSERT(state.cursor == 1 && state.anchor == 2);
+}
+
+void testScriptedKey(MockFcitxThread &fcitx, FcitxQtInputContextProxy &proxy) {
+    QString commit;
+    auto connection =
+        QObject::connect(&proxy, &FcitxQtInputContextProxy::commitString,
+                         [&commit](const QString &str) { commit = str; });
+    fcitx.run([](MockFcitx &mock) {
+        mock.setKeyHandler([](MockFcitx &mock, const MockKeyEvent &event) {
+            if (event.keyval != 0x61) {
+                return false;
+            }
+            if (!event.isRelease) {
+                mock.commitString(event.ic, QStringLiteral("A"));
+            }
+            return true;
+        });
+    });
+
+    auto reply = proxy.processKeyEvent(0x61, 38, 0, false, 0);
+    reply.waitForFinished();
+    FCITX_ASSERT(reply.value());
+    FCITX_ASSERT(waitFor([&commit]() { return !commit.isEmpty(); }));
+    FCITX_ASSERT(commit == QLatin1String("A"));
+
+    reply = proxy.processKeyEvent(0x62, 56, 0, false, 0);
+    reply.waitForFinished();
+    FCITX_ASSERT(!reply.isError());
+    FCITX_ASSERT(!reply.value());
+    QObject::disconnect(connection);
+}
+
+void testFailure(MockFcitxThread &fcitx, FcitxQtInputContextProxy &proxy) {
+    fcitx.run([](MockFcitx &mock) {
+        mock.failCalls(QStringLiteral("ProcessKeyEvent"));
+    });
+    auto reply = proxy.processKeyEvent(0x61, 38, 0, false, 0);
+    reply.waitForFinished();
+    FCITX_ASSERT(reply.isError());
+
+    // Only the next call fails.
+    reply = proxy.processKeyEvent(0x61, 38, 0, false, 0);
+    reply.waitForFinished();
+    FCITX_ASSERT(!reply.isError());
+}
+
+// Signals of all input contexts share one subscription, each one still only
+// reaches its own proxy.
+void testDispatch(MockFcitxThread &fcitx, FcitxQtWatcher &watcher,
+                  FcitxQtInputContextProxy &proxy) {
+    const int ic = fcitx->inputContexts();
+    FcitxQtInputContextProxy other(&watcher, nullptr);
+    FCITX_ASSERT(waitFor([&other]() { return other.isValid(); }));
+    const int otherIC = fcitx->inputContexts();
+    FCITX_ASSERT(otherIC != ic);
+
+    QStringList commits;
+    QStringList otherCommits;
+    auto connection =
+        QObject::connect(&proxy, &FcitxQtInputContextProxy::commitString,
+                         [&commits](const QString &str) { commits << str; });
+    QObject::connect(
+        &other, &FcitxQtInputContextProxy::commitString,
+        [&otherCommits](const QString &str) { otherCommits << str; });
+    fcitx.run([ic, otherIC](MockFcitx &mock) {
+        mock.commitString(otherIC, QStringLiteral("other"));
+        mock.commitString(ic, QStringLiteral("first"));
+    });
+    FCITX_ASSERT(waitFor([&commits]() { return !commits.isEmpty(); }));
+    FCITX_ASSERT(commits == QStringList{QStringLiteral("first")});
+    FCITX_ASSERT(otherCommits == QStringList{QStringLiteral("other")});
+    QObject::disconnect(connection);
+}
+
+// Features are detected once per fcitx instance, and shared by all proxies.
+void testFeatures(MockFcitxThread &fcitx, FcitxQtWatcher &watcher,
+                  FcitxQtInputContextProxy &proxy) {
+    const auto name = fcitx->uniqueName();
+    FCITX_ASSERT(waitFor([&watcher, &name]() {
+        return watcher.features(name) != FcitxQtWatcher::NoFeature;
+    }));
+    FCITX_ASSERT(watcher.features(name) ==
+                 (FcitxQtWatcher::InvokeActionFeature |
+                  FcitxQtWatcher::KeyFilterFeature |
+                  FcitxQtWatcher::ProcessKeyEventWithStateFeature));
+    FCITX_ASSERT(proxy.supportInvokeAction());
+    FCITX_ASSERT(proxy.supportKeyFilter());
+    FCITX_ASSERT(proxy.supportProcessKeyEventWithState());
+
+    FcitxQtInputContextProxy other(&watcher, nullptr);
+    FCITX_ASSERT(waitFor([&other]() { return other.isValid(); }));
+    // Known as soon as the input context is created.
+    FCITX_ASSERT(other.supportProcessKeyEventWithState());
+}
+
+// Keys outside of the key filter published by fcitx are not wanted.
+void testKeyFilter(MockFcitxThread &fcitx, FcitxQtInputContextProxy &proxy) {
+    const int ic = fcitx->inputContexts();
+    FCITX_ASSERT(proxy.supportKeyFilter());
+    FCITX_ASSERT(proxy.wantsKey(FcitxKey_Return, 0));
+
+    FcitxQtKeyFilterRule rule;
+    rule.setFirst(FcitxKey_a);
+    rule.setLast(FcitxKey_z);
+    rule.setStateMask(0);
+    rule.setState(0);
+    fcitx.run([ic, rule](MockFcitx &mock) {
+        mock.updateKeyFilter(ic, true, {rule});
+    });
+    FCITX_ASSERT(waitFor(
+        [&proxy]() { return !proxy.wantsKey(FcitxKey_Return, 0); }));
+    FCITX_ASSERT(proxy.wantsKey(FcitxKey_a, 0));
+    FCITX_ASSERT(proxy.wantsKey(FcitxKey_z, 0));
+
+    // A disabled filter wants every key again.
+    fcitx.run([ic, rule](MockFcitx &mock) {
+        mock.updateKeyFilter(ic, false, {rule});
+    });
+    FCITX_ASSERT(
+        waitFor([&proxy]() { return proxy.wantsKey(FcitxKey_Return, 0); }));
+}
+
+// After a restart, creating the input context is tried again with backoff
+// until it succeeds.
+void testReconnect(MockFcitxThread &fcitx, FcitxQtInputContextProxy &proxy) {
+    fcitx.stop();
+    FCITX_ASSERT(waitFor([&proxy]() { return !proxy.isValid(); }));
+    fcitx.start();
+    // Input contexts are only created after a delay, so this is in time.
+    fcitx.run([](MockFcitx &mock) {
+        mock.failCalls(QStringLiteral("CreateInputContext"), 2);
+    });
+    FCITX_ASSERT(waitFor([&proxy]() { return proxy.isValid(); }));
+    FCITX_ASSERT(fcitx->callCount(QStringLiteral("CreateInputContext")) == 3);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    TestDBusDaemon daemon;
+    if (!daemon.isValid()) {
+        FCITX_INFO() << "dbus-daemon is not available, skip.";
+        return 0;
+    }
+
+    auto bus = QDBusConnection::connectToBus(daemon.address(),
+                                             QStringLiteral("client"));
+    {
+        MockFcitxThread fcitx(daemon.address());
+        FcitxQtWatcher watcher(bus);
+        watcher.watch();
+        FcitxQtInputContextProxy proxy(&watcher, nullptr);
+        FCITX_ASSERT(waitFor([&proxy]() { return proxy.isValid(); }));
+        FCITX_ASSERT(watcher.serviceOwner() == fcitx->uniqueName());
+        FCITX_ASSERT(fcitx->inputContexts() == 1);
+        FCITX_ASSERT(fcitx->inputContext(1).program ==
+                     QCoreApplication::applicationName());
+
+        testFeatures(fcitx, watcher, proxy);
+        testSignals(fcitx, proxy);
+        testClientSideUI(fcitx, proxy);
+        testState(fcitx, proxy);
+        testScriptedKey(fcitx, proxy);
+        testFailure(fcitx, proxy);
+        testDispatch(fcitx, watcher, proxy);
+        testKeyFilter(fcitx, proxy);
+
+        // A reply that never comes does not block the following ones.
+        fcitx.run([](MockFcitx &mock) {
+            mock.dropReplies(QStringLiteral("ProcessKeyEvent"));
+        });
+        auto dropped = proxy.processKeyEvent(0x61, 38, 0, false, 0);
+        auto next = proxy.processKeyEvent(0x61, 38, 0, true, 0);
+        next.waitForFinished();
+        FCITX_ASSERT(!next.isError());
+        FCITX_ASSERT(!dropped.isFinished());
+
+        // The pending call fails once fcitx is gone, and the proxy creates a
+        // new input context with the restarted fcitx.
+        fcitx.restart();
+        dropped.waitForFinished();
+        FCITX_ASSERT(dropped.isError());
+        FCITX_ASSERT(waitFor([&fcitx, &proxy]() {
+            return fcitx->inputContexts() == 1 && proxy.isValid();
+        }));
+        testFeatures(fcitx, watcher, proxy);
+        testSignals(fcitx, proxy);
+        testDispatch(fcitx, watcher, proxy);
+        testKeyFilter(fcitx, proxy);
+        testReconnect(fcitx, proxy);
+        testSignals(fcitx, proxy);
+    }
+    QDBusConnection::disconnectFromBus(bus.name());
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "keyeventqueue.h"
+#include <QCoreApplication>
+#include <cstdlib>
+#include <fcitx-utils/log.h>
+
+#ifdef __GLIBC__
+namespace {
+bool countAllocations = false;
+size_t allocations = 0;
+} // namespace
+
+// Count every allocation, Qt's containers use malloc directly instead of
+// operator new.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    if (countAllocations) {
+        ++allocations;
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    if (countAllocations) {
+        ++allocations;
+    }
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (countAllocations) {
+        ++allocations;
+    }
+    return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+using namespace fcitx;
+
+void testOrder() {
+    KeyEventQueue queue(4);
+    FCITX_ASSERT(queue.capacity() == 4);
+    FCITX_ASSERT(queue.empty());
+
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 4; i++) {
+            FCITX_ASSERT(!queue.full());
+            auto index = queue.push();
+            queue.slot(index).event.key = i;
+            FCITX_ASSERT(queue.back().event.key == i);
+            FCITX_ASSERT(queue.back().mergedRepeats == 0);
+            queue.back().mergedRepeats = i;
+        }
+        FCITX_ASSERT(queue.full());
+        // Finishing out of order does not change the order of the queue.
+        queue.slot(queue.indexAt(2)).finished = true;
+        FCITX_ASSERT(!queue.front().finished);
+        for (int i = 0; i < 4; i++) {
+            FCITX_ASSERT(queue.front().event.key == i);
+            queue.pop();
+        }
+        FCITX_ASSERT(queue.empty());
+        // Make sure we wrap around.
+        queue.push();
+        queue.pop();
+    }
+}
+
+void testNoAllocation() {
+    KeyEventQueue queue(16);
+    QKeyEvent press(QEvent::KeyPress, Qt::Key_A, Qt::NoModifier, 38, 0x61, 0,
+                    QStringLiteral("a"));
+    QKeyEvent release(QEvent::KeyRelease, Qt::Key_A, Qt::NoModifier, 38, 0x61,
+                      0, QStringLiteral("a"));
+
+#ifdef __GLIBC__
+    countAllocations = true;
+#endif
+    for (int i = 0; i < 1000; i++) {
+        auto index = queue.push();
+        queue.slot(index).event.set(i % 2 ? release : press);
+        if (queue.size() > 3) {
+            queue.front().finished = true;
+            KeyEventQueue::Entry entry = queue.front();
+            queue.pop();
+            FCITX_ASSERT(entry.event.nativeVirtualKey == 0x61);
+        }
+    }
+#ifdef __GLIBC__
+    countAllocations = false;
+    FCITX_ASSERT(allocations == 0) << allocations;
+#endif
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    testOrder();
+    testNoAllocation();
+
+    return 0;
+}
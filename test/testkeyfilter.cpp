@@ -0,0 +1,58 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "fcitxqtdbustypes.h"
+#include <QCoreApplication>
+#include <fcitx-utils/keysym.h>
+#include <fcitx-utils/log.h>
+
+using namespace fcitx;
+
+FcitxQtKeyFilterRule makeRule(quint32 first, quint32 last, quint32 stateMask,
+                              quint32 state) {
+    FcitxQtKeyFilterRule rule;
+    rule.setFirst(first);
+    rule.setLast(last);
+    rule.setStateMask(stateMask);
+    rule.setState(state);
+    return rule;
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    const quint32 ctrl = static_cast<quint32>(KeyState::Ctrl);
+    const quint32 shift = static_cast<quint32>(KeyState::Shift);
+    const quint32 modifiers = static_cast<quint32>(KeyState::SimpleMask);
+
+    // Ctrl+Space, and any key with Ctrl+Shift.
+    FcitxQtKeyFilterRuleList rules;
+    rules << makeRule(FcitxKey_space, FcitxKey_space, modifiers, ctrl);
+    rules << makeRule(0, 0xffffffff, ctrl | shift, ctrl | shift);
+
+    FCITX_ASSERT(rules[0].matches(FcitxKey_space, ctrl));
+    FCITX_ASSERT(!rules[0].matches(FcitxKey_space, 0));
+    FCITX_ASSERT(!rules[0].matches(FcitxKey_space, ctrl | shift));
+    FCITX_ASSERT(!rules[0].matches(FcitxKey_a, ctrl));
+
+    FCITX_ASSERT(keyFilterMatches(rules, FcitxKey_space, ctrl));
+    FCITX_ASSERT(keyFilterMatches(rules, FcitxKey_space, ctrl | shift));
+    FCITX_ASSERT(keyFilterMatches(rules, FcitxKey_a, ctrl | shift));
+    FCITX_ASSERT(!keyFilterMatches(rules, FcitxKey_a, 0));
+    FCITX_ASSERT(!keyFilterMatches(rules, FcitxKey_a, ctrl));
+    FCITX_ASSERT(!keyFilterMatches({}, FcitxKey_a, 0));
+
+    // A range of keysym regardless of modifier state.
+    rules.clear();
+    rules << makeRule(FcitxKey_a, FcitxKey_z, 0, 0);
+    FCITX_ASSERT(keyFilterMatches(rules, FcitxKey_a, 0));
+    FCITX_ASSERT(keyFilterMatches(rules, FcitxKey_m, ctrl));
+    FCITX_ASSERT(keyFilterMatches(rules, FcitxKey_z, shift));
+    FCITX_ASSERT(!keyFilterMatches(rules, FcitxKey_A, shift));
+    FCITX_ASSERT(!keyFilterMatches(rules, FcitxKey_Return, 0));
+
+    return 0;
+}
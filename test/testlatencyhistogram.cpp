@@ -0,0 +1,53 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "latencyhistogram.h"
+#include <fcitx-utils/log.h>
+
+using namespace fcitx;
+
+// Percentiles are only exact up to the bucket size.
+bool near(quint64 value, quint64 expect) {
+    return value >= expect && value <= expect + expect / 16;
+}
+
+int main() {
+    LatencyHistogram histogram;
+    FCITX_ASSERT(histogram.count() == 0);
+    FCITX_ASSERT(histogram.percentile(50) == 0);
+
+    // Small values are exact.
+    for (quint64 i = 1; i <= 20; i++) {
+        histogram.record(i);
+    }
+    FCITX_ASSERT(histogram.count() == 20);
+    FCITX_ASSERT(histogram.percentile(50) == 10) << histogram.percentile(50);
+    FCITX_ASSERT(histogram.percentile(100) == 20);
+    FCITX_ASSERT(histogram.max() == 20);
+
+    histogram.reset();
+    FCITX_ASSERT(histogram.count() == 0);
+    FCITX_ASSERT(histogram.max() == 0);
+
+    for (quint64 i = 1; i <= 1000; i++) {
+        histogram.record(i * 100);
+    }
+    FCITX_ASSERT(near(histogram.percentile(50), 50000))
+        << histogram.percentile(50);
+    FCITX_ASSERT(near(histogram.percentile(95), 95000))
+        << histogram.percentile(95);
+    FCITX_ASSERT(near(histogram.percentile(99), 99000))
+        << histogram.percentile(99);
+    FCITX_ASSERT(histogram.percentile(100) == 100000);
+    FCITX_ASSERT(histogram.max() == 100000);
+
+    // Huge values are clamped instead of overflowing the buckets.
+    histogram.record(1ull << 60);
+    FCITX_ASSERT(histogram.max() < (1ull << 60));
+    FCITX_ASSERT(histogram.percentile(100) == histogram.max());
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "fcitxqtinputcontextproxy.h"
+#include "fcitxqtwatcher.h"
+#include "mockfcitx.h"
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <fcitx-utils/log.h>
+
+using namespace fcitx;
+
+namespace {
+
+// Sends a key and returns whether it arrives over a peer to peer connection.
+bool sendKey(MockFcitxThread &fcitx, FcitxQtInputContextProxy &proxy) {
+    bool peerToPeer = false;
+    fcitx.run([&peerToPeer](MockFcitx &mock) {
+        mock.setKeyHandler(
+            [&peerToPeer](MockFcitx &, const MockKeyEvent &event) {
+                peerToPeer = event.peerToPeer;
+                return true;
+            });
+    });
+    auto reply = proxy.processKeyEvent(0x61, 38, 0, false, 0);
+    reply.waitForFinished();
+    FCITX_ASSERT(!reply.isError()) << reply.error().message().toStdString();
+    FCITX_ASSERT(reply.value());
+    return peerToPeer;
+}
+
+void testConnection(const QString &address, bool daemonPeerToPeer) {
+    auto bus = QDBusConnection::connectToBus(address, QStringLiteral("client"));
+    {
+        MockFcitxOptions options;
+        options.peerToPeer = daemonPeerToPeer;
+        MockFcitxThread fcitx(address, options);
+        FcitxQtWatcher watcher(bus);
+        watcher.setPeerToPeer(true);
+        watcher.watch();
+        FCITX_ASSERT(waitFor([&watcher]() { return watcher.availability(); }));
+        FCITX_ASSERT(watcher.isPeerToPeerConnected() == daemonPeerToPeer);
+
+        FcitxQtInputContextProxy proxy(&watcher, nullptr);
+        FCITX_ASSERT(waitFor([&proxy]() { return proxy.isValid(); }));
+        FCITX_ASSERT(sendKey(fcitx, proxy) == daemonPeerToPeer);
+
+        // Restart fcitx, the peer to peer connection needs to be set up
+        // again with the new instance.
+        fcitx.stop();
+        FCITX_ASSERT(waitFor([&watcher]() { return !watcher.availability(); }));
+        FCITX_ASSERT(!watcher.isPeerToPeerConnected());
+        fcitx.start();
+        FCITX_ASSERT(waitFor([&watcher]() { return watcher.availability(); }));
+        FCITX_ASSERT(watcher.isPeerToPeerConnected() == daemonPeerToPeer);
+        FCITX_ASSERT(waitFor([&proxy]() { return proxy.isValid(); }));
+        FCITX_ASSERT(sendKey(fcitx, proxy) == daemonPeerToPeer);
+    }
+    QDBusConnection::disconnectFromBus(bus.name());
+}
+
+void testOtherService(const QString &address) {
+    auto bus = QDBusConnection::connectToBus(address, QStringLiteral("client"));
+    {
+        MockFcitxOptions options;
+        options.peerToPeer = true;
+        MockFcitxThread fcitx(address, options);
+        FcitxQtWatcher watcher(bus);
+        watcher.setPeerToPeer(true);
+        watcher.setWatchPortal(true);
+        watcher.watch();
+        FCITX_ASSERT(waitFor([&watcher]() { return watcher.availability(); }));
+        FCITX_ASSERT(watcher.isPeerToPeerConnected());
+
+        // The peer address came from org.fcitx.Fcitx5, the portal name coming
+        // and going keeps the connection.
+        auto other =
+            QDBusConnection::connectToBus(address, QStringLiteral("other"));
+        const auto portal = QStringLiteral("org.freedesktop.portal.Fcitx");
+        FCITX_ASSERT(other.registerService(portal));
+        // Let the watcher see each owner change.
+        waitFor([]() { return false; }, 200);
+        FCITX_ASSERT(watcher.isPeerToPeerConnected());
+        other.unregisterService(portal);
+        QDBusConnection::disconnectFromBus(other.name());
+        waitFor([]() { return false; }, 200);
+        FCITX_ASSERT(watcher.availability());
+        FCITX_ASSERT(watcher.isPeerToPeerConnected());
+    }
+    QDBusConnection::disconnectFromBus(bus.name());
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    TestDBusDaemon daemon;
+    if (!daemon.isValid()) {
+        FCITX_INFO() << "dbus-daemon is not available, skip.";
+        return 0;
+    }
+    const auto &address = daemon.address();
+
+    testConnection(address, true);
+    // Fall back to the bus if fcitx has no peer to peer address.
+    testConnection(address, false);
+    testOtherService(address);
+
+    return 0;
+}
@@ -0,0 +1,363 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+
+// Drives the fcitx5 platform input context on the offscreen platform, against
+// a mock fcitx on a private bus.
+
+#include "fcitxflags.h"
+#include "mockfcitx.h"
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QInputMethodEvent>
+#include <QInputMethodQueryEvent>
+#include <QKeyEvent>
+#include <QTemporaryDir>
+#include <QWindow>
+#include <fcitx-utils/keysym.h>
+#include <fcitx-utils/log.h>
+#include <memory>
+#include <qpa/qplatforminputcontext.h>
+#include <qpa/qplatforminputcontextfactory_p.h>
+#include <utility>
+#include <vector>
+
+using namespace fcitx;
+
+namespace {
+
+struct ReceivedKey {
+    QEvent::Type type;
+    quint32 keysym;
+    int count;
+    bool autoRepeat;
+};
+
+class TestWindow : public QWindow {
+public:
+    // Keys that reach the window.
+    std::vector<ReceivedKey> keys;
+    QStringList commits;
+
+protected:
+    bool event(QEvent *event) override {
+        switch (event->type()) {
+        case QEvent::InputMethodQuery: {
+            auto *query = static_cast<QInputMethodQueryEvent *>(event);
+            if (query->queries() & Qt::ImEnabled) {
+                query->setValue(Qt::ImEnabled, true);
+            }
+            if (query->queries() & Qt::ImHints) {
+                query->setValue(Qt::ImHints, static_cast<int>(Qt::ImhNone));
+            }
+            if (query->queries() & Qt::ImCursorRectangle) {
+                query->setValue(Qt::ImCursorRectangle, QRect(0, 0, 1, 10));
+            }
+            query->accept();
+            return true;
+        }
+        case QEvent::KeyPress:
+        case QEvent::KeyRelease: {
+            auto *keyEvent = static_cast<QKeyEvent *>(event);
+            keys.push_back({event->type(), keyEvent->nativeVirtualKey(),
+                            keyEvent->count(), keyEvent->isAutoRepeat()});
+            return true;
+        }
+        case QEvent::InputMethod: {
+            const auto &commit =
+                static_cast<QInputMethodEvent *>(event)->commitString();
+            if (!commit.isEmpty()) {
+                commits << commit;
+            }
+            return true;
+        }
+        default:
+            break;
+        }
+        return QWindow::event(event);
+    }
+};
+
+bool sendKey(QPlatformInputContext &context, QEvent::Type type, int key,
+             quint32 keysym, bool autoRepeat = false) {
+    QKeyEvent event(type, key, Qt::NoModifier, 0, keysym, 0, QString(),
+                    autoRepeat);
+    return context.filterEvent(&event);
+}
+
+// Waits until everything fcitx sent so far has reached the client.
+void sync(MockFcitxThread &fcitx, TestWindow &window) {
+    const int ic = fcitx->inputContexts();
+    bool synced = false;
+    // The signal is lost if the input context is not set up on the client
+    // side yet, try again in that case.
+    for (int i = 0; i < 10 && !synced; i++) {
+        fcitx.run([ic](MockFcitx &mock) {
+            mock.commitString(ic, QStringLiteral("sync"));
+        });
+        synced = waitFor(
+            [&window]() {
+                return window.commits.contains(QStringLiteral("sync"));
+            },
+            500);
+    }
+    FCITX_ASSERT(synced);
+    window.commits.clear();
+}
+
+void setKeyFilter(MockFcitxThread &fcitx, TestWindow &window, bool enabled) {
+    const int ic = fcitx->inputContexts();
+    FcitxQtKeyFilterRule rule;
+    rule.setFirst(FcitxKey_a);
+    rule.setLast(FcitxKey_z);
+    rule.setStateMask(0);
+    rule.setState(0);
+    fcitx.run([ic, enabled, rule](MockFcitx &mock) {
+        mock.updateKeyFilter(ic, enabled, {rule});
+    });
+    sync(fcitx, window);
+}
+
+// Keys outside of the key filter are handled without a call to fcitx, after
+// the keys before them.
+void testKeyFilter(MockFcitxThread &fcitx, QPlatformInputContext &context,
+                   TestWindow &window) {
+    setKeyFilter(fcitx, window, true);
+    fcitx->resetCounters();
+    window.keys.clear();
+
+    // Nothing is pending, left to the application right away.
+    FCITX_ASSERT(
+        !sendKey(context, QEvent::KeyPress, Qt::Key_Return, FcitxKey_Return));
+    FCITX_ASSERT(!sendKey(context, QEvent::KeyRelease, Qt::Key_Return,
+                          FcitxKey_Return));
+    FCITX_ASSERT(sendKey(context, QEvent::KeyPress, Qt::Key_A, FcitxKey_a));
+    FCITX_ASSERT(waitFor([&window]() { return window.keys.size() == 1; }));
+    FCITX_ASSERT(window.keys[0].keysym == FcitxKey_a);
+    FCITX_ASSERT(fcitx->keys() == 1);
+
+    // Replies are only handled by the event loop, so the key is still
+    // pending, and the next key waits for it.
+    window.keys.clear();
+    FCITX_ASSERT(sendKey(context, QEvent::KeyPress, Qt::Key_B, FcitxKey_b));
+    FCITX_ASSERT(
+        sendKey(context, QEvent::KeyPress, Qt::Key_Return, FcitxKey_Return));
+    FCITX_ASSERT(waitFor([&window]() { return window.keys.size() == 2; }));
+    FCITX_ASSERT(window.keys[0].keysym == FcitxKey_b);
+    FCITX_ASSERT(window.keys[1].keysym == FcitxKey_Return);
+    FCITX_ASSERT(fcitx->keys() == 2) << fcitx->keys();
+
+    setKeyFilter(fcitx, window, false);
+}
+
+// Sends a held key, the first press and count pairs of release and press.
+void sendRepeats(QPlatformInputContext &context, int key, quint32 keysym,
+                 int count) {
+    FCITX_ASSERT(sendKey(context, QEvent::KeyPress, key, keysym, true));
+    for (int i = 0; i < count; i++) {
+        FCITX_ASSERT(sendKey(context, QEvent::KeyRelease, key, keysym, true));
+        FCITX_ASSERT(sendKey(context, QEvent::KeyPress, key, keysym, true));
+    }
+}
+
+// Repeats merged while earlier keys are pending reach the application as
+// one event with a count, and only the first pending repeat of a key fcitx
+// wants is sent.
+void testRepeatMerge(MockFcitxThread &fcitx, QPlatformInputContext &context,
+                     TestWindow &window) {
+    setKeyFilter(fcitx, window, true);
+    fcitx->resetCounters();
+    window.keys.clear();
+
+    // Keep a key pending, so the repeats queue up behind it.
+    FCITX_ASSERT(sendKey(context, QEvent::KeyPress, Qt::Key_A, FcitxKey_a));
+    sendRepeats(context, Qt::Key_Right, FcitxKey_Right, 2);
+    sendRepeats(context, Qt::Key_B, FcitxKey_b, 2);
+    FCITX_ASSERT(waitFor([&window]() { return window.keys.size() == 3; }))
+        << window.keys.size();
+    FCITX_ASSERT(fcitx->keys() == 2) << fcitx->keys();
+
+    FCITX_ASSERT(window.keys[0].keysym == FcitxKey_a);
+    FCITX_ASSERT(window.keys[1].keysym == FcitxKey_Right);
+    FCITX_ASSERT(window.keys[1].type == QEvent::KeyPress);
+    FCITX_ASSERT(window.keys[1].count == 3) << window.keys[1].count;
+    FCITX_ASSERT(window.keys[2].keysym == FcitxKey_b);
+    FCITX_ASSERT(window.keys[2].count == 1);
+    // Nothing else shows up later.
+    waitFor([]() { return false; }, 100);
+    FCITX_ASSERT(window.keys.size() == 3);
+
+    setKeyFilter(fcitx, window, false);
+}
+
+// A key held down while fcitx is slow does not keep typing after it is
+// released, the keys sent to fcitx are bounded by how fast it replies.
+void testRepeatWhileSlow(MockFcitxThread &fcitx,
+                         QPlatformInputContext &context, TestWindow &window) {
+    constexpr std::chrono::milliseconds latency(20);
+    constexpr int repeats = 50;
+    fcitx.run([latency](MockFcitx &mock) { mock.setKeyLatency(latency); });
+    fcitx->resetCounters();
+    window.keys.clear();
+
+    QElapsedTimer clock;
+    clock.start();
+    FCITX_ASSERT(
+        sendKey(context, QEvent::KeyPress, Qt::Key_Right, FcitxKey_Right));
+    for (int i = 0; i < repeats; i++) {
+        // Faster than fcitx replies.
+        waitFor([]() { return false; }, 2);
+        FCITX_ASSERT(sendKey(context, QEvent::KeyRelease, Qt::Key_Right,
+                             FcitxKey_Right, true));
+        FCITX_ASSERT(sendKey(context, QEvent::KeyPress, Qt::Key_Right,
+                             FcitxKey_Right, true));
+    }
+    FCITX_ASSERT(
+        sendKey(context, QEvent::KeyRelease, Qt::Key_Right, FcitxKey_Right));
+    const qint64 elapsed = clock.elapsed();
+    FCITX_ASSERT(waitFor([&window]() {
+        return !window.keys.empty() &&
+               window.keys.back().type == QEvent::KeyRelease &&
+               !window.keys.back().autoRepeat;
+    }));
+    // Only the release and press of one repeat wait for fcitx at any time,
+    // besides the first press and the release.
+    const quint64 bound = 3 + 2 * elapsed / latency.count();
+    FCITX_ASSERT(fcitx->keys() <= bound) << fcitx->keys() << " > " << bound;
+    FCITX_ASSERT(fcitx->keys() < 2 * repeats + 2);
+    const size_t received = window.keys.size();
+    waitFor([]() { return false; }, 100);
+    FCITX_ASSERT(window.keys.size() == received);
+
+    fcitx.run([](MockFcitx &mock) {
+        mock.setKeyLatency(std::chrono::microseconds(0));
+    });
+}
+
+QWindow *candidateWindow() {
+    for (auto *window : QGuiApplication::topLevelWindows()) {
+        if (window->inherits("fcitx::FcitxCandidateWindow")) {
+            return window;
+        }
+    }
+    return nullptr;
+}
+
+void showCandidates(MockFcitxThread &fcitx, int highlight) {
+    const int ic = fcitx->inputContexts();
+    FcitxQtStringKeyValueList candidates;
+    for (int i = 0; i < 3; i++) {
+        FcitxQtStringKeyValue candidate;
+        candidate.setKey(QStringLiteral("%1.").arg(i + 1));
+        candidate.setValue(QStringLiteral("candidate%1").arg(i));
+        candidates << candidate;
+    }
+    fcitx.run([ic, candidates, highlight](MockFcitx &mock) {
+        mock.updateClientSideUI(ic, {}, -1, {}, {}, candidates, highlight, 0,
+                                false, false);
+    });
+}
+
+bool deltaEnabled(MockFcitxThread &fcitx) {
+    return fcitx->inputContext(fcitx->inputContexts()).capability &
+           FcitxCapabilityFlag_ClientSideUIDelta;
+}
+
+// A highlight delta that arrives while the candidate window is gone turns
+// deltas off until fcitx sends the whole UI again.
+void testHighlightWhileHidden(MockFcitxThread &fcitx, TestWindow &window) {
+    const int ic = fcitx->inputContexts();
+    FCITX_ASSERT(waitFor([&fcitx]() { return deltaEnabled(fcitx); }));
+    showCandidates(fcitx, 0);
+    FCITX_ASSERT(waitFor([]() {
+        return candidateWindow() && candidateWindow()->isVisible();
+    }));
+    fcitx.run([ic](MockFcitx &mock) {
+        mock.updateClientSideUIHighlight(ic, 1, -1);
+    });
+    sync(fcitx, window);
+    FCITX_ASSERT(candidateWindow()->isVisible());
+    FCITX_ASSERT(deltaEnabled(fcitx));
+
+    // The candidate window goes away along with the window.
+    window.hide();
+    FCITX_ASSERT(waitFor([]() { return !candidateWindow(); }));
+    window.show();
+    window.requestActivate();
+    FCITX_ASSERT(waitFor([&window]() { return window.isActive(); }));
+
+    fcitx.run([ic](MockFcitx &mock) {
+        mock.updateClientSideUIHighlight(ic, 2, -1);
+    });
+    FCITX_ASSERT(waitFor([&fcitx]() { return !deltaEnabled(fcitx); }));
+    FCITX_ASSERT(!candidateWindow() || !candidateWindow()->isVisible());
+
+    // fcitx answers with the whole UI.
+    showCandidates(fcitx, 2);
+    FCITX_ASSERT(waitFor([]() {
+        return candidateWindow() && candidateWindow()->isVisible();
+    }));
+    FCITX_ASSERT(waitFor([&fcitx]() { return deltaEnabled(fcitx); }));
+
+    fcitx.run([ic](MockFcitx &mock) {
+        mock.updateClientSideUI(ic, {}, -1, {}, {}, {}, -1, 0, false, false);
+    });
+    FCITX_ASSERT(waitFor([]() { return !candidateWindow()->isVisible(); }));
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    qunsetenv("QT_IM_MODULE");
+    // Keep the compose cache out of the home directory.
+    qputenv("FCITX_QT_COMPOSE_CACHE", "0");
+    QGuiApplication app(argc, argv);
+
+    TestDBusDaemon daemon;
+    if (!daemon.isValid()) {
+        FCITX_INFO() << "dbus-daemon is not available, skip.";
+        return 0;
+    }
+    qputenv("DBUS_SESSION_BUS_ADDRESS", daemon.address().toUtf8());
+    MockFcitxThread fcitx(daemon.address());
+
+    // Plugins are looked up in the platforminputcontexts sub directory.
+    QTemporaryDir pluginDir;
+    QDir(pluginDir.path()).mkdir("platforminputcontexts");
+    const QFileInfo plugin(QStringLiteral(FCITX5_QT_PLUGIN_FILE));
+    QFile::link(plugin.absoluteFilePath(),
+                pluginDir.filePath("platforminputcontexts/" +
+                                   plugin.fileName()));
+    QCoreApplication::addLibraryPath(pluginDir.path());
+    std::unique_ptr<QPlatformInputContext> context(
+        QPlatformInputContextFactory::create(QStringLiteral("fcitx5")));
+    FCITX_ASSERT(context);
+
+    TestWindow window;
+    window.resize(100, 100);
+    window.show();
+    window.requestActivate();
+    FCITX_ASSERT(waitFor([&window]() { return window.isActive(); }));
+    context->setFocusObject(&window);
+    FCITX_ASSERT(waitFor([&fcitx]() {
+        return fcitx->inputContexts() > 0 &&
+               fcitx->inputContext(fcitx->inputContexts()).focused;
+    }));
+    sync(fcitx, window);
+
+    testKeyFilter(fcitx, *context, window);
+    testRepeatMerge(fcitx, *context, window);
+    testRepeatWhileSlow(fcitx, *context, window);
+    testHighlightWhileHidden(fcitx, window);
+
+    context.reset();
+    return 0;
+}